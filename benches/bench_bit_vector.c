@@ -0,0 +1,438 @@
+#include "bit_vector.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+static uint64_t random_state = 88172645463325252ULL;
+
+static uint64_t next_random(void)
+{
+    // Xorshift64, which is fast enough not to show up in query timings.
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_configuration(char const *name, uint64_t *words, size_t length, size_t *queries,
+                                size_t query_num, BitVectorOptions const *options)
+{
+    // Bits are borrowed unless they are to be copied into huge pages.
+    double start = now();
+    BitVector *bv = construct_bit_vector_from_words_with_options(words, length, !options->huge_pages, options);
+    double build_time = now() - start;
+
+    size_t sink = 0;
+    start = now();
+    for (size_t i = 0; i < query_num; ++i)
+    {
+        sink += rank_one(bv, queries[i]);
+    }
+    double rank_time = now() - start;
+
+    // Touch the output first to keep page faults out of the timing.
+    size_t *ranks = calloc(query_num, sizeof(size_t));
+    memset(ranks, 1, query_num * sizeof(size_t));
+    start = now();
+    rank_one_batch(bv, queries, query_num, ranks);
+    double rank_batch_time = now() - start;
+    sink += ranks[query_num - 1];
+    free(ranks);
+
+    size_t one_num = rank_one(bv, length);
+    start = now();
+    for (size_t i = 0; i < query_num; ++i)
+    {
+        sink += select_one(bv, queries[i] % one_num);
+    }
+    double select_time = now() - start;
+
+    size_t *select_queries = malloc(query_num * sizeof(size_t));
+    for (size_t i = 0; i < query_num; ++i)
+    {
+        select_queries[i] = queries[i] % one_num;
+    }
+    size_t *positions = calloc(query_num, sizeof(size_t));
+    memset(positions, 1, query_num * sizeof(size_t));
+    start = now();
+    select_one_batch(bv, select_queries, query_num, positions);
+    double select_batch_time = now() - start;
+    sink += positions[query_num - 1];
+    free(positions);
+    free(select_queries);
+
+    size_t directory_size = rank_directory_size(bv);
+    BitVectorSpaceUsage usage = bit_vector_space_usage(bv);
+    printf("%-24s build %8.3f s  rank %7.1f ns  batch %7.1f ns  select %7.1f ns  batch %7.1f ns  "
+           "rank directory %.2f%%  space %.3f bits/bit  [%zu]\n",
+           name, build_time, rank_time / query_num * 1e9, rank_batch_time / query_num * 1e9,
+           select_time / query_num * 1e9, select_batch_time / query_num * 1e9,
+           100.0 * directory_size * 8 / length, usage.total_bits_per_bit, sink);
+    printf("%-24s select_1 %.3f  select_0 %.3f  overhead %.3f bits/bit\n", "", usage.bits_per_bit[SPACE_SELECT_ONE],
+           usage.bits_per_bit[SPACE_SELECT_ZERO], usage.bits_per_bit[SPACE_ALLOCATOR_OVERHEAD]);
+
+    destruct_bit_vector(bv);
+}
+
+static void bench_dynamic(char const *name, uint64_t *words, size_t length, size_t *queries, size_t query_num)
+{
+    double start = now();
+    DynamicBitVector *dbv = construct_dynamic_bit_vector_from_words(words, length);
+    double build_time = now() - start;
+
+    size_t sink = 0;
+    start = now();
+    for (size_t i = 0; i < query_num; ++i)
+    {
+        sink += dynamic_rank_one(dbv, queries[i]);
+    }
+    double rank_time = now() - start;
+
+    size_t one_num = dynamic_rank_one(dbv, length);
+    start = now();
+    for (size_t i = 0; i < query_num; ++i)
+    {
+        sink += dynamic_select_one(dbv, queries[i] % one_num);
+    }
+    double select_time = now() - start;
+
+    // Insert and delete at the same random positions, keeping the length.
+    start = now();
+    for (size_t i = 0; i < query_num; ++i)
+    {
+        dynamic_insert_bit(dbv, queries[i] % length, queries[i] & 1);
+    }
+    double insert_time = now() - start;
+    start = now();
+    for (size_t i = 0; i < query_num; ++i)
+    {
+        sink += dynamic_delete_bit(dbv, queries[query_num - 1 - i] % length);
+    }
+    double delete_time = now() - start;
+    start = now();
+    for (size_t i = 0; i < query_num; ++i)
+    {
+        dynamic_flip_bit(dbv, queries[i] % length);
+    }
+    double flip_time = now() - start;
+
+    printf("%-24s build %8.3f s  rank %7.1f ns  select %7.1f ns  insert %7.1f ns  delete %7.1f ns  "
+           "flip %7.1f ns  [%zu]\n",
+           name, build_time, rank_time / query_num * 1e9, select_time / query_num * 1e9,
+           insert_time / query_num * 1e9, delete_time / query_num * 1e9, flip_time / query_num * 1e9, sink);
+
+    destruct_dynamic_bit_vector(dbv);
+}
+
+static void bench_append(char const *name, uint64_t *words, size_t length, size_t *queries, size_t query_num,
+                         BitVectorOptions *options)
+{
+    // Grow an empty bit vector a word at a time, timing every append to catch the worst one.
+    options->append_capacity = length;
+    BitVector *bv = construct_bit_vector_from_words_with_options(words, 0, false, options);
+    options->append_capacity = 0;
+    double max_time = 0;
+    double start = now();
+    for (size_t i = 0; i < length; i += 64)
+    {
+        double append_start = now();
+        push_back_bits(bv, words[i / 64], length - i < 64 ? length - i : 64);
+        double append_time = now() - append_start;
+        max_time = append_time > max_time ? append_time : max_time;
+    }
+    double append_time = now() - start;
+
+    size_t sink = 0;
+    start = now();
+    for (size_t i = 0; i < query_num; ++i)
+    {
+        sink += rank_one(bv, queries[i]);
+    }
+    double rank_time = now() - start;
+
+    size_t one_num = rank_one(bv, length);
+    start = now();
+    for (size_t i = 0; i < query_num; ++i)
+    {
+        sink += select_one(bv, queries[i] % one_num);
+    }
+    double select_time = now() - start;
+
+    size_t word_num = (length + 63) / 64;
+    printf("%-24s append %7.1f ns  max %9.1f ns  rank %7.1f ns  select %7.1f ns  [%zu]\n", name,
+           append_time / word_num * 1e9, max_time * 1e9, rank_time / query_num * 1e9, select_time / query_num * 1e9,
+           sink);
+
+    destruct_bit_vector(bv);
+}
+
+typedef struct SnapshotReader
+{
+    SnapshotBitVector *sbv;
+    size_t *queries;
+    size_t query_num;
+    double time;
+    size_t sink;
+} SnapshotReader;
+
+static void *read_snapshots(void *arg)
+{
+    // Take a fresh snapshot for every few queries, as a server would per request.
+    SnapshotReader *reader = arg;
+    double start = now();
+    for (size_t i = 0; i < reader->query_num; i += 16)
+    {
+        BitVectorSnapshot snapshot = acquire_snapshot(reader->sbv);
+        for (size_t q = i; q < i + 16 && q < reader->query_num; ++q)
+        {
+            reader->sink += snapshot_rank_one(snapshot, reader->queries[q]);
+        }
+        release_snapshot(reader->sbv, snapshot);
+    }
+    reader->time = now() - start;
+    return NULL;
+}
+
+static void bench_snapshot(char const *name, uint64_t *words, size_t length, size_t *queries, size_t query_num,
+                           size_t thread_num)
+{
+    double start = now();
+    SnapshotBitVector *sbv = construct_snapshot_bit_vector_from_words(words, length);
+    double build_time = now() - start;
+
+    // Readers run while batches of 64 random updates are applied.
+    pthread_t *threads = malloc(thread_num * sizeof(pthread_t));
+    SnapshotReader *readers = malloc(thread_num * sizeof(SnapshotReader));
+    for (size_t t = 0; t < thread_num; ++t)
+    {
+        readers[t] = (SnapshotReader){sbv, queries, query_num, 0, 0};
+        pthread_create(&threads[t], NULL, read_snapshots, &readers[t]);
+    }
+    BitUpdate updates[64];
+    size_t batch_num = 0;
+    double update_time = 0;
+    for (size_t i = 0; i + 64 <= query_num && batch_num < 1000; i += 64, ++batch_num)
+    {
+        for (size_t u = 0; u < 64; ++u)
+        {
+            updates[u] = (BitUpdate){queries[i + u] % length, queries[i + u] & 1};
+        }
+        start = now();
+        update_bits(sbv, updates, 64);
+        update_time += now() - start;
+    }
+    double rank_time = 0;
+    size_t sink = 0;
+    for (size_t t = 0; t < thread_num; ++t)
+    {
+        pthread_join(threads[t], NULL);
+        rank_time += readers[t].time;
+        sink += readers[t].sink;
+    }
+
+    printf("%-24s build %8.3f s  rank %7.1f ns  update %9.1f ns per batch of 64  [%zu]\n", name, build_time,
+           rank_time / thread_num / query_num * 1e9, update_time / (batch_num ? batch_num : 1) * 1e9, sink);
+
+    free(threads);
+    free(readers);
+    destruct_snapshot_bit_vector(sbv);
+}
+
+static void bench_executor(char const *name, uint64_t *words, size_t length, size_t *queries, size_t query_num,
+                           size_t thread_num)
+{
+    // Mix all four query types and compare the throughput of one thread with the pool.
+    BitVectorOptions options = {0};
+    options.rank_layout = RANK_LAYOUT_INTERLEAVED;
+    options.select_mode = SELECT_MODE_SAMPLED;
+    BitVector *bv = construct_bit_vector_from_words_with_options(words, length, true, &options);
+    size_t one_num = rank_one(bv, length);
+    Query *mixed = malloc(query_num * sizeof(Query));
+    for (size_t i = 0; i < query_num; ++i)
+    {
+        QueryType type = i % 4;
+        size_t limit = type == QUERY_SELECT_ONE ? one_num : type == QUERY_SELECT_ZERO ? length - one_num : length + 1;
+        mixed[i] = (Query){type, queries[i] % limit};
+    }
+    size_t *results = malloc(query_num * sizeof(size_t));
+
+    printf("%-24s", name);
+    double single_time = 0;
+    for (size_t threads = 1; threads <= thread_num; threads *= 2)
+    {
+        QueryExecutor *executor = construct_query_executor(threads);
+        double start = now();
+        execute_queries(executor, bv, mixed, query_num, results);
+        double time = now() - start;
+        single_time = threads == 1 ? time : single_time;
+        printf("  %zu threads %6.1f ns (x%.1f)", threads, time / query_num * 1e9, single_time / time);
+        destruct_query_executor(executor);
+    }
+    printf("\n");
+
+    free(mixed);
+    free(results);
+    destruct_bit_vector(bv);
+}
+
+int main(int argc, char **argv)
+{
+    size_t length = argc > 1 ? strtoull(argv[1], NULL, 10) : (size_t)1 << 28;
+    size_t query_num = argc > 2 ? strtoull(argv[2], NULL, 10) : (size_t)1 << 22;
+    size_t thread_num = argc > 3 ? strtoull(argv[3], NULL, 10) : 4;
+
+    size_t word_num = (length + 63) / 64;
+    uint64_t *words = malloc(word_num * sizeof(uint64_t));
+    for (size_t i = 0; i < word_num; ++i)
+    {
+        words[i] = next_random();
+    }
+
+    size_t *queries = malloc(query_num * sizeof(size_t));
+    for (size_t i = 0; i < query_num; ++i)
+    {
+        queries[i] = next_random() % (length + 1);
+    }
+
+    printf("%zu bits, %zu random queries\n", length, query_num);
+    BitVectorOptions options = {0};
+    bench_configuration("separate/tree", words, length, queries, query_num, &options);
+    options.huge_pages = true;
+    bench_configuration("separate/tree/huge", words, length, queries, query_num, &options);
+    options.huge_pages = false;
+    options.select_mode = SELECT_MODE_SAMPLED;
+    bench_configuration("separate/sampled", words, length, queries, query_num, &options);
+    options.huge_pages = true;
+    bench_configuration("separate/sampled/huge", words, length, queries, query_num, &options);
+    options.huge_pages = false;
+    options.rank_layout = RANK_LAYOUT_INTERLEAVED;
+    bench_configuration("interleaved/sampled", words, length, queries, query_num, &options);
+    options.huge_pages = true;
+    bench_configuration("interleaved/sampled/huge", words, length, queries, query_num, &options);
+    options.huge_pages = false;
+    options.numa_replicas = true;
+    bench_configuration("interleaved/sampled/numa", words, length, queries, query_num, &options);
+    options.numa_replicas = false;
+    options.thread_number = thread_num;
+    bench_configuration("interleaved/sampled/mt", words, length, queries, query_num, &options);
+    options.select_mode = SELECT_MODE_TREE;
+    bench_configuration("interleaved/tree/mt", words, length, queries, query_num, &options);
+    bench_dynamic("dynamic", words, length, queries, query_num);
+    options.thread_number = 0;
+    options.select_mode = SELECT_MODE_SAMPLED;
+    bench_append("interleaved/append", words, length, queries, query_num, &options);
+    bench_snapshot("snapshot", words, length, queries, query_num, thread_num);
+    bench_executor("executor", words, length, queries, query_num, thread_num);
+
+    // A sparse bit string with about 1.6% ones, where compressed encodings pay off.
+    for (size_t i = 0; i < word_num; ++i)
+    {
+        words[i] = next_random() & next_random() & next_random() & next_random() & next_random() & next_random();
+    }
+    printf("%zu bits with about 1.6%% ones\n", length);
+    options = (BitVectorOptions){0};
+    options.rank_layout = RANK_LAYOUT_INTERLEAVED;
+    options.select_mode = SELECT_MODE_SAMPLED;
+    bench_configuration("sparse/plain", words, length, queries, query_num, &options);
+    options.encoding = ENCODING_RRR;
+    bench_configuration("sparse/rrr/63", words, length, queries, query_num, &options);
+    options.rrr_block_length = 31;
+    bench_configuration("sparse/rrr/31", words, length, queries, query_num, &options);
+    options.encoding = ENCODING_ELIAS_FANO;
+    bench_configuration("sparse/elias-fano", words, length, queries, query_num, &options);
+
+    // A very sparse bit string with about 0.1% ones, where Elias-Fano takes the least space.
+    for (size_t i = 0; i < word_num; ++i)
+    {
+        uint64_t word = next_random();
+        for (size_t j = 0; j < 9; ++j)
+        {
+            word &= next_random();
+        }
+        words[i] = word;
+    }
+    printf("%zu bits with about 0.1%% ones\n", length);
+    options = (BitVectorOptions){0};
+    options.rank_layout = RANK_LAYOUT_INTERLEAVED;
+    options.select_mode = SELECT_MODE_SAMPLED;
+    bench_configuration("very-sparse/plain", words, length, queries, query_num, &options);
+    options.encoding = ENCODING_RRR;
+    bench_configuration("very-sparse/rrr/63", words, length, queries, query_num, &options);
+    options.encoding = ENCODING_ELIAS_FANO;
+    bench_configuration("very-sparse/elias-fano", words, length, queries, query_num, &options);
+
+    // A clustered bit string of runs of up to 64K ones and zeros, where run-length encoding
+    // takes the least space.
+    size_t position = 0;
+    bool bit = false;
+    memset(words, 0, word_num * sizeof(uint64_t));
+    while (position < length)
+    {
+        size_t run = next_random() % 65536 + 1;
+        for (size_t i = position; bit && i < position + run && i < length; ++i)
+        {
+            words[i / 64] |= (uint64_t)1 << (i % 64);
+        }
+        position += run;
+        bit = !bit;
+    }
+    printf("%zu bits in runs of up to 64K bits\n", length);
+    options = (BitVectorOptions){0};
+    options.rank_layout = RANK_LAYOUT_INTERLEAVED;
+    options.select_mode = SELECT_MODE_SAMPLED;
+    bench_configuration("runs/plain", words, length, queries, query_num, &options);
+    options.encoding = ENCODING_RRR;
+    bench_configuration("runs/rrr/63", words, length, queries, query_num, &options);
+    options.encoding = ENCODING_RUN_LENGTH;
+    bench_configuration("runs/run-length", words, length, queries, query_num, &options);
+
+    // A bit string alternating every 256K bits between dense, very sparse, clustered and
+    // empty regions, keeping the runs above for the clustered ones.
+    for (size_t i = 0; i < word_num; ++i)
+    {
+        size_t region = i / 4096 % 4;
+        if (region == 0)
+        {
+            words[i] = next_random();
+        }
+        else if (region == 1)
+        {
+            words[i] = next_random() & next_random() & next_random() & next_random() & next_random() &
+                       next_random() & next_random() & next_random() & next_random() & next_random();
+        }
+        else if (region == 3)
+        {
+            words[i] = 0;
+        }
+    }
+    printf("%zu bits of mixed regions\n", length);
+    options = (BitVectorOptions){0};
+    options.rank_layout = RANK_LAYOUT_INTERLEAVED;
+    options.select_mode = SELECT_MODE_SAMPLED;
+    bench_configuration("mixed/plain", words, length, queries, query_num, &options);
+    options.encoding = ENCODING_RRR;
+    bench_configuration("mixed/rrr/63", words, length, queries, query_num, &options);
+    options.encoding = ENCODING_ELIAS_FANO;
+    bench_configuration("mixed/elias-fano", words, length, queries, query_num, &options);
+    options.encoding = ENCODING_RUN_LENGTH;
+    bench_configuration("mixed/run-length", words, length, queries, query_num, &options);
+    options.encoding = ENCODING_HYBRID;
+    bench_configuration("mixed/hybrid", words, length, queries, query_num, &options);
+
+    free(queries);
+    free(words);
+    return 0;
+}
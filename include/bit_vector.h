@@ -2,15 +2,284 @@
 #define BIT_VECTOR_H 1
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
 
 typedef struct BitVector BitVector;
 
+typedef enum RankLayout
+{
+    // Block and subblock ranks in two arrays apart from the bits.
+    RANK_LAYOUT_SEPARATE,
+    // Rank9-style pairs of a block rank and packed subblock ranks for every 512 bits,
+    // so a query touches one cache line of directory and one of bits.
+    RANK_LAYOUT_INTERLEAVED,
+} RankLayout;
+
+typedef enum SelectMode
+{
+    // A tree of tables over every block of about (log2(n))^2 target bits.
+    SELECT_MODE_TREE,
+    // Positions of every 1024th target bit, finished with the rank directory and an
+    // in-word select, at a small fraction of the space of the trees.
+    SELECT_MODE_SAMPLED,
+} SelectMode;
+
+typedef enum Encoding
+{
+    // The bits as they are, with the rank directory and select structures on top.
+    ENCODING_PLAIN,
+    // RRR encoded blocks of the bits with a sampled rank directory, which select queries
+    // search as well. Low-entropy bit strings shrink several times.
+    ENCODING_RRR,
+    // Elias-Fano encoded positions of the ones, which take about 2 + log2(n / m) bits per
+    // one for `m` ones among `n` bits. Best for very sparse bit strings, where select_one
+    // takes constant time and rank searches the ones sharing the high bits of the index.
+    ENCODING_ELIAS_FANO,
+    // The starts of runs of ones and the ranks before them, both Elias-Fano encoded, which
+    // take space proportional to the number of runs. Best for long runs of ones and zeros,
+    // where rank and select search the runs.
+    ENCODING_RUN_LENGTH,
+    // Blocks of 65536 bits, each stored as plain words, positions of its ones, runs of its
+    // ones, or nothing when it is all zeros or all ones, whichever takes the least space.
+    // Best for bit strings mixing dense, sparse and clustered regions.
+    ENCODING_HYBRID,
+} Encoding;
+
+// Options for constructing a bit vector. A zero-initialized struct gives the defaults.
+typedef struct BitVectorOptions
+{
+    RankLayout rank_layout;
+    SelectMode select_mode;
+    // The number of threads used for construction, where 0 and 1 both mean the calling
+    // thread only. Rank and select structures are built from chunks of the bit string in
+    // parallel, and rank and both select structures are built at the same time.
+    size_t thread_number;
+    // Whether to defer the select structures of zeros and ones until the first select query
+    // on them or a call to `build_select_structures`, so that bit vectors only queried with
+    // rank are built faster and smaller. Deferred structures are built safely even when
+    // the first queries come from several threads at once.
+    bool lazy_select;
+    // How the bits are stored. Encodings other than `ENCODING_PLAIN` ignore the rank layout,
+    // the select mode and the options above, and cannot be saved.
+    Encoding encoding;
+    // The number of bits of every RRR block, from 1 to 63, where 0 means 63. Shorter blocks
+    // decode faster while longer ones compress better.
+    size_t rrr_block_length;
+    // The number of bits up to which `push_back_bits` may grow the bit vector, or 0 to keep
+    // it fixed. Address space for the bits and their structures up to this capacity is
+    // reserved at construction but only committed as they grow. Requires `ENCODING_PLAIN`
+    // and `SELECT_MODE_SAMPLED`.
+    size_t append_capacity;
+    // Whether to keep a replica of the bits and all structures on every NUMA node, built by
+    // a thread of that node, and answer queries with the replica on the node of the calling
+    // thread. This multiplies the space by the number of nodes and builds select structures
+    // of the replicas eagerly. Ignored on machines with a single node and by encodings other
+    // than `ENCODING_PLAIN`.
+    bool numa_replicas;
+    // Whether to put the bits, the rank directory and the select structures in memory aligned
+    // to 2 MB huge pages, taken from the reserved huge pages of the system if there are any
+    // and as transparent huge pages otherwise, so that random queries on large bit vectors
+    // miss the TLB less often. Arrays smaller than a huge page and borrowed bits stay where
+    // they are. Ignored by encodings other than `ENCODING_PLAIN`.
+    bool huge_pages;
+} BitVectorOptions;
+
+// Parts of a bit vector whose space is reported by `bit_vector_space_usage`.
+typedef enum SpaceComponent
+{
+    // The bits themselves.
+    SPACE_PAYLOAD,
+    // Absolute block ranks, or the absolute half of every interleaved pair.
+    SPACE_RANK_BLOCKS,
+    // Relative subblock ranks, or the packed half of every interleaved pair.
+    SPACE_RANK_SUBBLOCKS,
+    // Tables shared by queries of all positions.
+    SPACE_LOOKUP_TABLES,
+    SPACE_SELECT_ONE,
+    SPACE_SELECT_ZERO,
+    // Arena space not used by any structure, bookkeeping, and the padding of saved files.
+    SPACE_ALLOCATOR_OVERHEAD,
+    SPACE_COMPONENT_NUMBER,
+} SpaceComponent;
+
+// The space used by every component of a bit vector in bytes and in bits per bit of the
+// bit string.
+typedef struct BitVectorSpaceUsage
+{
+    size_t bytes[SPACE_COMPONENT_NUMBER];
+    double bits_per_bit[SPACE_COMPONENT_NUMBER];
+    size_t total_bytes;
+    double total_bits_per_bit;
+} BitVectorSpaceUsage;
+
 BitVector *construct_bit_vector(char const *const bits_str);
+BitVector *construct_bit_vector_with_options(char const *const bits_str, BitVectorOptions const *options);
+
+// Construct a bit vector of `length` bits packed in `words`, where bit `i` is bit `i % 64`
+// of `words[i / 64]`. If `borrow` is true, `words` is used in place instead of being copied,
+// and it must outlive the bit vector. Construction only reads the buffer, so it may be
+// read-only memory such as a mapped file.
+BitVector *construct_bit_vector_from_words(uint64_t const *words, size_t length, bool borrow);
+BitVector *construct_bit_vector_from_words_with_options(uint64_t const *words, size_t length, bool borrow,
+                                                        BitVectorOptions const *options);
+
+// Construct a bit vector of `length` bits whose ones are at `positions`, which must be
+// strictly increasing and less than `length`. With `ENCODING_ELIAS_FANO`, the bits are
+// never materialized, so very sparse bit vectors are built in time and space proportional
+// to the number of ones.
+BitVector *construct_bit_vector_from_positions(size_t const *positions, size_t n, size_t length,
+                                               BitVectorOptions const *options);
+
 void destruct_bit_vector(BitVector *bv);
 
-size_t rank_one(BitVector *bv, size_t index);
-size_t rank_zero(BitVector *bv, size_t index);
-size_t select_one(BitVector *bv, size_t index);
-size_t select_zero(BitVector *bv, size_t index);
+// Save the bit vector to `path` in a flat format that `map_bit_vector` uses in place.
+// Select structures are always saved in `SELECT_MODE_SAMPLED`. Only bit vectors encoded
+// with `ENCODING_PLAIN` can be saved. Returns false on failure.
+bool save_bit_vector(BitVector const *bv, char const *path);
+
+// Map a file written by `save_bit_vector` read-only and query it without any
+// deserialization, sharing its pages with other processes mapping the same file.
+// Loading only checks the header and the section bounds, in O(1) time, so that no page
+// beyond them is read. The file must not change while mapped. Returns NULL on failure.
+BitVector *map_bit_vector(char const *path);
+
+// Queries take const bit vectors and may run concurrently from any number of threads without
+// locking. They never write to the bit vector, except to build the select structures deferred
+// by `lazy_select` once, behind an internal lock taken only until they are built. Functions
+// taking a non-const bit vector must not run concurrently with queries.
+size_t rank_one(BitVector const *bv, size_t index);
+size_t rank_zero(BitVector const *bv, size_t index);
+
+// Answer `n` rank queries at once, storing the rank of `indexes[i]` in `ranks[i]`.
+// Queries are interleaved with prefetches, which is much faster than a loop of single
+// queries on bit vectors larger than the cache.
+void rank_one_batch(BitVector const *bv, size_t const *indexes, size_t n, size_t *ranks);
+void rank_zero_batch(BitVector const *bv, size_t const *indexes, size_t n, size_t *ranks);
+
+size_t select_one(BitVector const *bv, size_t index);
+size_t select_zero(BitVector const *bv, size_t index);
+
+// Answer `n` select queries at once, storing the position of the `indexes[i]`-th target bit
+// in `positions[i]`. Queries walk the select structures together with prefetches, trading
+// the latency of single queries for throughput.
+void select_one_batch(BitVector const *bv, size_t const *indexes, size_t n, size_t *positions);
+void select_zero_batch(BitVector const *bv, size_t const *indexes, size_t n, size_t *positions);
+
+typedef enum QueryType
+{
+    QUERY_RANK_ONE,
+    QUERY_RANK_ZERO,
+    QUERY_SELECT_ONE,
+    QUERY_SELECT_ZERO,
+} QueryType;
+
+typedef struct Query
+{
+    QueryType type;
+    size_t index;
+} Query;
+
+// A pool of threads answering batches of mixed queries. Batches are split into chunks of
+// 512 queries, which threads take from their own share and steal from others once done,
+// synchronizing once per chunk rather than per query.
+typedef struct QueryExecutor QueryExecutor;
+
+// Start `thread_number - 1` worker threads, which wait for batches between runs. The thread
+// submitting a batch works on it too, and 0 or 1 runs batches on that thread alone.
+QueryExecutor *construct_query_executor(size_t thread_number);
+void destruct_query_executor(QueryExecutor *executor);
+
+// Answer `n` queries, storing the answer to `queries[i]` in `results[i]`, and return when all
+// of them are answered. Queries of every type in a chunk are answered together by the batch
+// functions above. Batches submitted from several threads run one after another.
+void execute_queries(QueryExecutor *executor, BitVector const *bv, Query const *queries, size_t n, size_t *results);
+
+// Append the low `bit_number` bits of `word`, at most 64, to a bit vector constructed with
+// an `append_capacity`. The rank directory and select samples are extended in amortized O(1)
+// time per word and grow in place without copying, so queries stay valid between appends.
+// Appends must not run concurrently with queries.
+void push_back_bits(BitVector *bv, uint64_t word, size_t bit_number);
+
+// Build the select structures deferred by `lazy_select` now instead of on first use.
+// Does nothing for structures that are already built.
+void build_select_structures(BitVector *bv);
+
+// The number of bytes used by the rank directory in the chosen layout.
+size_t rank_directory_size(BitVector const *bv);
+
+// Measure the space used by the bit vector. Select structures that are not built yet
+// take no space, and select trees are walked, which takes time linear in their size.
+BitVectorSpaceUsage bit_vector_space_usage(BitVector const *bv);
+
+// A bit vector that supports updates, backed by a balanced tree whose leaves pack up to 2048
+// bits into words and whose inner nodes count the bits and ones under every child. All
+// operations take O(log n) time.
+typedef struct DynamicBitVector DynamicBitVector;
+
+DynamicBitVector *construct_dynamic_bit_vector(void);
+// Construct a dynamic bit vector of `length` bits packed in `words` in linear time.
+DynamicBitVector *construct_dynamic_bit_vector_from_words(uint64_t const *words, size_t length);
+void destruct_dynamic_bit_vector(DynamicBitVector *dbv);
+
+size_t dynamic_length(DynamicBitVector const *dbv);
+bool dynamic_get_bit(DynamicBitVector const *dbv, size_t index);
+
+// Insert `bit` before position `index`, which may equal the length to append it.
+void dynamic_insert_bit(DynamicBitVector *dbv, size_t index, bool bit);
+// Remove the bit at `index`, returning it.
+bool dynamic_delete_bit(DynamicBitVector *dbv, size_t index);
+
+void dynamic_set_bit(DynamicBitVector *dbv, size_t index);
+void dynamic_clear_bit(DynamicBitVector *dbv, size_t index);
+void dynamic_flip_bit(DynamicBitVector *dbv, size_t index);
+
+size_t dynamic_rank_one(DynamicBitVector const *dbv, size_t index);
+size_t dynamic_rank_zero(DynamicBitVector const *dbv, size_t index);
+size_t dynamic_select_one(DynamicBitVector const *dbv, size_t index);
+size_t dynamic_select_zero(DynamicBitVector const *dbv, size_t index);
+
+// A fixed-length bit vector updated copy-on-write while readers query consistent snapshots.
+// Bits are split into blocks of 4096 bits under a tree of nodes with 64 children, which count
+// the ones under every child. Versions share the tree, and an update copies only the blocks it
+// touches and the nodes on the paths to them. Queries descend the tree in O(log b) time for
+// `b` blocks. Readers never block or wait on the writer, and replaced nodes and blocks are
+// freed once no reader holds a snapshot that can reach them.
+typedef struct SnapshotBitVector SnapshotBitVector;
+typedef struct SnapshotVersion SnapshotVersion;
+
+// A version of the bit vector held by a reader until it is released.
+typedef struct BitVectorSnapshot
+{
+    SnapshotVersion const *version;
+    size_t epoch;
+} BitVectorSnapshot;
+
+// Set the bit at `index` to `bit`.
+typedef struct BitUpdate
+{
+    size_t index;
+    bool bit;
+} BitUpdate;
+
+SnapshotBitVector *construct_snapshot_bit_vector_from_words(uint64_t const *words, size_t length);
+// All snapshots must be released before.
+void destruct_snapshot_bit_vector(SnapshotBitVector *sbv);
+
+// Take a snapshot of the latest version, which stays unchanged until it is released.
+BitVectorSnapshot acquire_snapshot(SnapshotBitVector *sbv);
+void release_snapshot(SnapshotBitVector *sbv, BitVectorSnapshot snapshot);
+
+// Apply `n` updates in order as a single new version. Updates from several threads are
+// serialized, and take O(n log b) time, copying at most one block and O(log b) nodes for
+// every bit they change.
+void update_bits(SnapshotBitVector *sbv, BitUpdate const *updates, size_t n);
+
+size_t snapshot_length(BitVectorSnapshot snapshot);
+bool snapshot_get_bit(BitVectorSnapshot snapshot, size_t index);
+size_t snapshot_rank_one(BitVectorSnapshot snapshot, size_t index);
+size_t snapshot_rank_zero(BitVectorSnapshot snapshot, size_t index);
+size_t snapshot_select_one(BitVectorSnapshot snapshot, size_t index);
+size_t snapshot_select_zero(BitVectorSnapshot snapshot, size_t index);
 
 #endif
@@ -0,0 +1,159 @@
+#include "arena.h"
+#include "numa.h"
+#include "huge_page.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Chunks are aligned to cache lines so that any supported alignment can be served.
+#define CHUNK_ALIGNMENT 64
+
+// Chunks stop doubling at this size, so that the unused tail of the last chunk stays small
+// next to the structures of large bit vectors.
+#define MAX_CHUNK_SIZE ((size_t)64 << 20)
+
+/********** Declarations of Private Functions **********/
+
+typedef struct ArenaChunk ArenaChunk;
+
+static ArenaChunk *construct_chunk(size_t size, bool huge_pages);
+
+/********** Definitions of `Arena` and Public Functions **********/
+
+struct ArenaChunk
+{
+    ArenaChunk *next;
+    size_t size;
+    size_t used;
+    uint8_t *data;
+
+    // Whether the data is mapped by `huge_page_alloc` rather than allocated by malloc.
+    bool huge;
+};
+
+struct Arena
+{
+    // Chunks form a list with the current one at the head.
+    ArenaChunk *chunks;
+
+    // The size of the next chunk, which doubles every time one is started up to
+    // `MAX_CHUNK_SIZE`, so that the number of chunks grows slowly with the total size.
+    size_t chunk_size;
+
+    bool huge_pages;
+};
+
+Arena *construct_arena(size_t chunk_size, bool huge_pages)
+{
+    Arena *arena = malloc(sizeof(Arena));
+    arena->chunks = NULL;
+    arena->chunk_size = chunk_size > CHUNK_ALIGNMENT ? chunk_size : CHUNK_ALIGNMENT;
+    arena->huge_pages = huge_pages;
+    return arena;
+}
+
+void destruct_arena(Arena *arena)
+{
+    ArenaChunk *chunk = arena->chunks;
+    while (chunk)
+    {
+        ArenaChunk *next = chunk->next;
+        if (chunk->huge)
+        {
+            huge_page_free(chunk->data, chunk->size);
+        }
+        else
+        {
+            free(chunk->data);
+        }
+        free(chunk);
+        chunk = next;
+    }
+    free(arena);
+}
+
+void *arena_alloc(Arena *arena, size_t size, size_t alignment)
+{
+    ArenaChunk *chunk = arena->chunks;
+    if (chunk)
+    {
+        size_t start = (chunk->used + alignment - 1) & ~(alignment - 1);
+        if (start + size <= chunk->size)
+        {
+            chunk->used = start + size;
+            return chunk->data + start;
+        }
+    }
+
+    // Allocations larger than half the next chunk that do not fit get a chunk of their own
+    // behind the current one, so that neither the tail of the current chunk nor most of a
+    // doubled chunk is left unused.
+    if (chunk && size > arena->chunk_size / 2)
+    {
+        ArenaChunk *own_chunk = construct_chunk(size, arena->huge_pages);
+        own_chunk->next = chunk->next;
+        chunk->next = own_chunk;
+        own_chunk->used = size;
+        return own_chunk->data;
+    }
+
+    // Start a new chunk, which is large enough for the allocation anyway.
+    size_t chunk_size = arena->chunk_size;
+    while (chunk_size < size)
+    {
+        chunk_size *= 2;
+    }
+    arena->chunk_size = chunk_size < MAX_CHUNK_SIZE / 2 ? chunk_size * 2 : MAX_CHUNK_SIZE;
+
+    chunk = construct_chunk(chunk_size, arena->huge_pages);
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    chunk->used = size;
+    return chunk->data;
+}
+
+size_t arena_size(Arena *arena)
+{
+    size_t size = sizeof(Arena);
+    for (ArenaChunk *chunk = arena->chunks; chunk; chunk = chunk->next)
+    {
+        size += sizeof(ArenaChunk) + chunk->size;
+    }
+    return size;
+}
+
+void arena_bind(Arena *arena, size_t node)
+{
+    for (ArenaChunk *chunk = arena->chunks; chunk; chunk = chunk->next)
+    {
+        if (chunk->huge)
+        {
+            bv_numa_bind(chunk->data, chunk->size, node);
+        }
+    }
+}
+
+/********** Definitions for Private Functions **********/
+
+static ArenaChunk *construct_chunk(size_t size, bool huge_pages)
+{
+    // Chunks of huge pages take up all of their last huge page, and chunks too small for a
+    // huge page come from malloc anyway.
+    ArenaChunk *chunk = malloc(sizeof(ArenaChunk));
+    chunk->data = huge_pages ? huge_page_alloc(size) : NULL;
+    chunk->huge = chunk->data;
+    if (chunk->huge)
+    {
+        size = huge_page_round(size);
+    }
+    else
+    {
+        size = (size + CHUNK_ALIGNMENT - 1) & ~(size_t)(CHUNK_ALIGNMENT - 1);
+        chunk->data = aligned_alloc(CHUNK_ALIGNMENT, size);
+    }
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
@@ -0,0 +1,26 @@
+#ifndef ARENA_H
+#define ARENA_H 1
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// A bump allocator over a few large chunks, whose memory is only released all at once.
+typedef struct Arena Arena;
+
+// Chunks start at `chunk_size` bytes, except for large allocations that get chunks of their
+// own. With `huge_pages`, chunks of at least a huge page are
+// mapped by `huge_page_alloc`.
+Arena *construct_arena(size_t chunk_size, bool huge_pages);
+void destruct_arena(Arena *arena);
+
+// Allocate `size` bytes aligned to `alignment`, which must be a power of 2 no larger than 64.
+void *arena_alloc(Arena *arena, size_t size, size_t alignment);
+
+// The number of bytes held by the arena, including unused space and bookkeeping.
+size_t arena_size(Arena *arena);
+
+// Move the chunks of huge pages allocated so far to NUMA node `node`, as a hint. Chunks from
+// malloc share pages with other allocations, and stay where they were first touched.
+void arena_bind(Arena *arena, size_t node);
+
+#endif
@@ -1,4 +1,14 @@
 #include "../include/bit_vector.h"
+#include "arena.h"
+#include "region.h"
+#include "parallel.h"
+#include "rrr.h"
+#include "elias_fano.h"
+#include "run_length.h"
+#include "hybrid.h"
+#include "word.h"
+#include "numa.h"
+#include "huge_page.h"
 
 #include <stddef.h>
 #include <stdlib.h>
@@ -7,495 +17,2447 @@
 #include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define HAS_X86_DISPATCH 1
+#endif
+
+#define WORD_BITS 64
+#define PARSE_BLOCK_CHARS 64
+
+// Interleaved rank directories cover 8 words with a pair of words: an absolute rank and
+// seven 9-bit ranks of the words relative to the start of the basic block.
+#define INTERLEAVED_BLOCK_WORDS 8
+#define INTERLEAVED_SUBBLOCK_BITS 9
+
+// Sampled select structures record the position of every `SELECT_SAMPLE_RATE`-th target bit.
+#define SELECT_SAMPLE_RATE 1024
+#define MAX_RRR_BLOCK_LENGTH 63
+
+// Saved bit vectors start with this magic string, and every section of them is aligned
+// to a cache line.
+#define FILE_MAGIC "BITVECT"
+#define FILE_VERSION 1
+#define FILE_ALIGNMENT 64
+
+// Batched queries are processed in groups, prefetching for the next group while
+// answering the current one so that many cache misses are in flight at once.
+#define BATCH_GROUP_SIZE 16
+
+// Batched rank queries prefetch the lines of the query this many places ahead.
+#define RANK_PREFETCH_DISTANCE 64
+
+// Parallel construction splits the words into about this many chunks per thread, so that
+// threads finishing early can take over remaining chunks.
+#define BUILD_CHUNKS_PER_THREAD 4
 
 /********** Declarations of Private Functions **********/
 
-static size_t select_target(BitVector *bv, size_t index, bool target);
-static void build_rank(BitVector *bv);
-static void build_select(BitVector *bv, bool target);
-static size_t *build_long_select_structure(BitVector *bv, size_t start, size_t end);
-static size_t ***build_short_select_structure(BitVector *bv, size_t start, size_t end);
-static void find_bit(BitVector *bv, size_t index, uint8_t **byte, uint8_t *mask);
-static bool is_bit_set(BitVector *bv, size_t index);
-static void set_bit(BitVector *bv, size_t index);
+typedef struct FileHeader FileHeader;
+typedef struct BuildContext BuildContext;
+typedef struct ReplicaBuild ReplicaBuild;
+
+static void build_structures(BitVector *bv, BitVectorOptions const *options);
+static void encode_bits(BitVector *bv);
+static void init_encoded(BitVector *bv);
+static void replicate(BitVector *bv);
+static void build_replica(void *replica_build);
+static void bind_to_node(BitVector *bv, size_t node);
+static BitVector const *local_replica(BitVector const *bv);
+static void check_positions(size_t const *positions, size_t n, size_t length);
+static inline size_t rank_plain(BitVector const *bv, size_t index) __attribute__((always_inline));
+static inline void rank_plain_batch(BitVector const *bv, size_t const *indexes, size_t n, size_t *ranks)
+    __attribute__((always_inline));
+static size_t encoded_rank_one(BitVector const *bv, size_t index);
+static size_t encoded_select(BitVector const *bv, size_t index, bool target);
+static void encoded_space_usage(BitVector const *bv, size_t *bytes);
+static void plain_space_usage(BitVector const *bv, size_t *bytes);
+static void init_chunks(BitVector *bv, BuildContext *context);
+static void allocate_select(BitVector *bv, bool target, size_t target_num);
+static void require_select(BitVector const *bv, bool target);
+static void build_lazy_select(BitVector *bv, bool target);
+static void prefetch_rank(BitVector const *bv, size_t index);
+static size_t select_target(BitVector const *bv, size_t index, bool target);
+static size_t select_sampled_target(BitVector const *bv, size_t index, bool target);
+static void select_target_batch(BitVector const *bv, size_t const *indexes, size_t n, size_t *positions, bool target);
+static void select_tree_group(BitVector const *bv, size_t const *indexes, size_t n, size_t *positions, bool target);
+static void select_sampled_group(BitVector const *bv, size_t const *indexes, size_t n, size_t *positions, bool target);
+static void build_select(BuildContext *context);
+static void count_chunk_task(void *context, size_t chunk, size_t thread);
+static void build_chunk_task(void *context, size_t chunk, size_t thread);
+static void select_block_task(void *context, size_t task, size_t thread);
+static inline void count_chunk(BuildContext *context, size_t chunk) __attribute__((always_inline));
+static inline void build_chunk(BuildContext *context, size_t chunk) __attribute__((always_inline));
+static inline void build_rank_chunk(BuildContext *context, size_t chunk) __attribute__((always_inline));
+static inline void build_interleaved_rank_chunk(BuildContext *context, size_t chunk) __attribute__((always_inline));
+static inline void fill_positions(BitVector const *bv, size_t first_word, size_t last_word, size_t const *counters,
+                                  size_t rate, size_t offset, size_t *const *positions) __attribute__((always_inline));
+static bool write_section(FILE *file, void const *data, size_t size, uint64_t *offset);
+static void get_section_sizes(FileHeader const *header, size_t *sizes);
+static bool check_header(FileHeader const *header, size_t file_size);
+static bool check_sample_numbers(BitVector const *bv);
+static size_t *build_long_select_structure(BitVector *bv, Arena *arena, bool target, size_t start, size_t end);
+static size_t ***build_short_select_structure(BitVector *bv, Arena *arena, bool target, size_t start,
+                                              size_t end);
+static void count_tree_nodes(BitVector const *bv, size_t start, size_t end, size_t *node_nums);
+static size_t select_space(BitVector const *bv, bool target);
+static void *aux_alloc(BitVector *bv, size_t size);
+static uint64_t *alloc_bits(BitVector *bv, size_t word_num, BitVectorOptions const *options);
+static void free_bits(BitVector *bv);
+static void *growable_alloc(BitVector *bv, Region **region, size_t size, size_t reserved_size);
+static void init_appendable(BitVector *bv);
+static void commit_region(Region *region, size_t size);
+static void set_rank_entry(BitVector *bv, size_t word, size_t rank);
+static size_t lg_length(BitVector const *bv);
+static size_t parse_bits_str(char const *bits_str, size_t str_length, uint64_t *words);
+static void classify_chars(char const *chars, uint64_t *ones, uint64_t *data, uint64_t *separators);
+static void classify_chars_scalar(char const *chars, size_t char_number, uint64_t *ones, uint64_t *data,
+                                  uint64_t *separators);
+#ifdef __SSE2__
+static void classify_chars_sse2(char const *chars, uint64_t *ones, uint64_t *data, uint64_t *separators);
+#endif
+#ifdef HAS_X86_DISPATCH
+static size_t rank_plain_popcnt(BitVector const *bv, size_t index) __attribute__((target("popcnt")));
+static void rank_plain_batch_popcnt(BitVector const *bv, size_t const *indexes, size_t n, size_t *ranks)
+    __attribute__((target("popcnt")));
+static void count_chunk_popcnt(BuildContext *context, size_t chunk) __attribute__((target("popcnt")));
+static void build_chunk_popcnt(BuildContext *context, size_t chunk) __attribute__((target("popcnt")));
+static void classify_chars_avx2(char const *chars, uint64_t *ones, uint64_t *data, uint64_t *separators)
+    __attribute__((target("avx2")));
+static uint64_t compress_bits_bmi2(uint64_t value, uint64_t mask) __attribute__((target("bmi2")));
+#endif
+static uint64_t compress_bits(uint64_t value, uint64_t mask);
+static uint64_t get_word(BitVector const *bv, size_t word);
+static uint64_t get_bits(BitVector const *bv, size_t start, size_t length);
+static uint64_t get_target_bits(BitVector const *bv, bool target, size_t start, size_t length);
 
 /********** Definitions of `BitVector` and Public Functions **********/
 
+// The header of a saved bit vector. Sections are byte offsets from the start of the file
+// for the bits, the rank blocks or interleaved rank directory, the rank subblocks, and
+// the select_0 and select_1 samples, in that order.
+struct FileHeader
+{
+    char magic[8];
+    uint64_t version;
+    uint64_t file_size;
+    uint64_t length;
+    uint64_t rank_layout;
+    uint64_t rank_block_length;
+    uint64_t select_sample_number[2];
+    uint64_t sections[5];
+};
+
+// The state shared by the tasks of construction.
+struct BuildContext
+{
+    BitVector *bv;
+
+    // Construction works on chunks of `chunk_words` words, and `chunk_ranks` records the
+    // number of ones before every chunk, with the total number of ones at the end.
+    size_t chunk_words;
+    size_t chunk_number;
+    size_t *chunk_ranks;
+
+    // Whether the rank directory and the select structures of zeros and ones are built.
+    bool rank;
+    bool targets[2];
+};
+
+// A replica to be built on a thread of another NUMA node.
+struct ReplicaBuild
+{
+    BitVector const *bv;
+    BitVectorOptions const *options;
+    BitVector *replica;
+};
+
 struct BitVector
 {
-    // The original bit string.
+    // The original bit string, packed into 64-bit words with bit `i` at
+    // position `i % 64` of word `i / 64`.
     size_t length;
-    uint8_t *bits;
+    uint64_t const *bits;
+    bool owns_bits;
+
+    // The size of owned bits mapped by `huge_page_alloc`, or 0 if they are from calloc.
+    size_t huge_bits_size;
+
+    // The whole file if the bit vector is mapped by `map_bit_vector`, or NULL.
+    void *mapping;
+    size_t mapping_size;
+
+    BitVectorOptions options;
+
+    // All rank and select structures are allocated from the arenas, one for each thread
+    // used during construction.
+    size_t arena_number;
+    Arena **arenas;
+
+    // Bit vectors with an `append_capacity` keep the bits, the rank directory and the select
+    // samples in regions instead, which grow in place. Rank regions hold the blocks or the
+    // interleaved pairs first and the subblocks second.
+    Region *bits_region;
+    Region *rank_regions[2];
+    Region *select_regions[2];
 
-    // Rank structures.
+    // Rank structures for `RANK_LAYOUT_SEPARATE`.
+    // Blocks record absolute ranks and subblocks, one per word, record ranks relative to
+    // their blocks, so a query only needs two loads and a popcount of the final word.
     size_t rank_block_length;
-    size_t rank_subblock_length;
     size_t *rank_blocks;
-    size_t *rank_subblocks;
-    size_t **rank_subblock_table;
+    uint16_t *rank_subblocks;
 
-    // Select structures.
+    // Rank structures for `RANK_LAYOUT_INTERLEAVED`.
+    uint64_t *rank_interleaved;
+
+    // Select structures for `SELECT_MODE_TREE`.
     size_t select_block_one_number;
     size_t *select_block_number;
     bool **select_block_types;
     size_t **select_blocks;
     void ***select_block_structures;
+
+    // Select structures for `SELECT_MODE_SAMPLED`.
+    size_t select_sample_number[2];
+    size_t *select_samples[2];
+
+    // The encoded bit string for encodings other than `ENCODING_PLAIN`, which replaces the
+    // bits and all other structures.
+    RrrVector *rrr;
+    EliasFanoVector *ef;
+    RunLengthVector *rl;
+    HybridVector *hybrid;
+
+    // Whether the select structures of zeros and ones are ready. Lazy select structures are
+    // built under `select_mutex` and published by setting these flags.
+    atomic_bool select_built[2];
+    pthread_mutex_t select_mutex;
+
+    // Replicas for `numa_replicas`, one for every NUMA node, with the bit vector itself
+    // standing for the node it was constructed on. Replicas have none of their own.
+    size_t replica_number;
+    BitVector **replicas;
 };
 
 BitVector *construct_bit_vector(char const *const bits_str)
+{
+    return construct_bit_vector_with_options(bits_str, NULL);
+}
+
+BitVector *construct_bit_vector_with_options(char const *const bits_str, BitVectorOptions const *options)
+{
+    BitVector *bv = malloc(sizeof(BitVector));
+
+    // Pack the bit string into words, skipping "_" and " " separators.
+    size_t str_length = strlen(bits_str);
+    uint64_t *bits = alloc_bits(bv, word_number(str_length), options);
+    bv->length = parse_bits_str(bits_str, str_length, bits);
+    bv->bits = bits;
+    bv->owns_bits = true;
+
+    build_structures(bv, options);
+    return bv;
+}
+
+BitVector *construct_bit_vector_from_words(uint64_t const *words, size_t length, bool borrow)
+{
+    return construct_bit_vector_from_words_with_options(words, length, borrow, NULL);
+}
+
+BitVector *construct_bit_vector_from_words_with_options(uint64_t const *words, size_t length, bool borrow,
+                                                        BitVectorOptions const *options)
 {
     BitVector *bv = malloc(sizeof(BitVector));
+    bv->length = length;
 
-    // Remove "_" and " " separators in the original bit string.
-    bv->length = 0;
-    char *cleaned_bits_str = malloc(strlen(bits_str) * sizeof(char));
-    for (size_t i = 0; bits_str[i]; ++i)
+    if (borrow)
     {
-        if (bits_str[i] == '_' || bits_str[i] == ' ')
-        {
-        }
-        else if (bits_str[i] == '0' || bits_str[i] == '1')
+        bv->bits = words;
+        bv->owns_bits = false;
+        bv->huge_bits_size = 0;
+    }
+    else
+    {
+        size_t word_num = word_number(length);
+        uint64_t *bits = alloc_bits(bv, word_num, options);
+        memcpy(bits, words, word_num * sizeof(uint64_t));
+
+        // Clear the unused tail so that the copy is canonical.
+        if (length % WORD_BITS)
         {
-            cleaned_bits_str[bv->length++] = bits_str[i];
+            bits[word_num - 1] &= ((uint64_t)1 << (length % WORD_BITS)) - 1;
         }
-        else
+        bv->bits = bits;
+        bv->owns_bits = true;
+    }
+
+    build_structures(bv, options);
+
+    return bv;
+}
+
+BitVector *construct_bit_vector_from_positions(size_t const *positions, size_t n, size_t length,
+                                               BitVectorOptions const *options)
+{
+    check_positions(positions, n, length);
+    BitVector *bv = malloc(sizeof(BitVector));
+    bv->length = length;
+
+    // Elias-Fano vectors are encoded from the positions directly.
+    if (options && options->encoding == ENCODING_ELIAS_FANO)
+    {
+        if (options->append_capacity)
         {
-            fprintf(stderr, "Error: Unknown character `%c` in the input bit string.\n", bits_str[i]);
+            fprintf(stderr, "Error: Appendable bit vectors must use `ENCODING_PLAIN` and `SELECT_MODE_SAMPLED`.\n");
             exit(EXIT_FAILURE);
         }
+        bv->options = *options;
+        bv->bits = NULL;
+        bv->owns_bits = false;
+        bv->huge_bits_size = 0;
+        bv->mapping = NULL;
+        bv->mapping_size = 0;
+        bv->rrr = NULL;
+        bv->rl = NULL;
+        bv->hybrid = NULL;
+        bv->ef = construct_elias_fano_vector(positions, n, length);
+        init_encoded(bv);
+        return bv;
     }
 
-    // Build a flipped bit string first.
-    size_t byte_num = ceil(bv->length / (double)8);
-    bv->bits = calloc(byte_num, 8);
-    for (size_t i = 0; i < bv->length; ++i)
+    uint64_t *bits = alloc_bits(bv, word_number(length), options);
+    for (size_t i = 0; i < n; ++i)
     {
-        if (cleaned_bits_str[i] == '0')
+        bits[positions[i] / WORD_BITS] |= (uint64_t)1 << (positions[i] % WORD_BITS);
+    }
+    bv->bits = bits;
+    bv->owns_bits = true;
+
+    build_structures(bv, options);
+    return bv;
+}
+
+void destruct_bit_vector(BitVector *bv)
+{
+    // Free the replicas on other nodes.
+    for (size_t node = 0; node < bv->replica_number; ++node)
+    {
+        if (bv->replicas[node] != bv)
         {
-            set_bit(bv, i);
+            destruct_bit_vector(bv->replicas[node]);
         }
     }
+    free(bv->replicas);
 
-    // Use the flipped bit string to build select_0 structures.
-    bv->select_block_number = malloc(2 * sizeof(size_t));
-    bv->select_block_types = malloc(2 * sizeof(bool *));
-    bv->select_blocks = malloc(2 * sizeof(size_t *));
-    bv->select_block_structures = malloc(2 * sizeof(void ****));
-    build_select(bv, 0);
+    // Free the bit string.
+    if (bv->owns_bits)
+    {
+        free_bits(bv);
+    }
+
+    // Free the rank and select structures.
+    Region *regions[] = {bv->bits_region, bv->rank_regions[0], bv->rank_regions[1], bv->select_regions[0],
+                         bv->select_regions[1]};
+    for (size_t i = 0; i < sizeof(regions) / sizeof(Region *); ++i)
+    {
+        if (regions[i])
+        {
+            destruct_region(regions[i]);
+        }
+    }
+    for (size_t i = 0; i < bv->arena_number; ++i)
+    {
+        destruct_arena(bv->arenas[i]);
+    }
+    free(bv->arenas);
 
-    // Restore a normal bit string.
-    for (size_t i = 0; i < byte_num; ++i)
+    // Unmap the file together with all structures in it.
+    if (bv->mapping)
     {
-        bv->bits[i] = ~bv->bits[i];
+        munmap(bv->mapping, bv->mapping_size);
     }
 
-    // Build rank_1 and select_1 structures.
-    build_rank(bv);
-    build_select(bv, 1);
+    // Free the encoded bit string.
+    if (bv->rrr)
+    {
+        destruct_rrr_vector(bv->rrr);
+    }
+    if (bv->ef)
+    {
+        destruct_elias_fano_vector(bv->ef);
+    }
+    if (bv->rl)
+    {
+        destruct_run_length_vector(bv->rl);
+    }
+    if (bv->hybrid)
+    {
+        destruct_hybrid_vector(bv->hybrid);
+    }
 
-    free(cleaned_bits_str);
-    return bv;
+    pthread_mutex_destroy(&bv->select_mutex);
+    free(bv);
 }
 
-void destruct_bit_vector(BitVector *bv)
+bool save_bit_vector(BitVector const *bv, char const *path)
 {
-    // Free the bit string.
-    free(bv->bits);
+    if (bv->options.encoding != ENCODING_PLAIN)
+    {
+        fprintf(stderr, "Error: Only plain bit vectors can be saved.\n");
+        return false;
+    }
 
-    // Free the rank structures.
-    free(bv->rank_blocks);
-    free(bv->rank_subblocks);
-    size_t pattern_num = pow(2, bv->rank_subblock_length);
-    for (size_t i = 0; i < pattern_num; ++i)
+    FILE *file = fopen(path, "wb");
+    if (!file)
     {
-        free(bv->rank_subblock_table[i]);
+        fprintf(stderr, "Error: Cannot open `%s` for writing.\n", path);
+        return false;
     }
-    free(bv->rank_subblock_table);
 
-    // Free the select structures.
+    // Saved bit vectors always use sampled select structures, which are pointer-free,
+    // so compute them first for bit vectors with select trees.
+    size_t *samples[2];
+    size_t sample_numbers[2];
     for (size_t target = 0; target < 2; ++target)
     {
-        for (size_t block = 0; block < bv->select_block_number[target]; ++block)
+        if (bv->options.select_mode == SELECT_MODE_SAMPLED)
         {
-            if (bv->select_block_types[target][block])
-            {
-                size_t *positions = bv->select_block_structures[target][block];
-                free(positions);
-            }
-            else
-            {
-                // Free 1st to 7th levels.
-                size_t ***tree = bv->select_block_structures[target][block];
-                size_t node_num = 1;
-                size_t ary_num = sqrt(sqrt(bv->select_block_one_number));
-                for (size_t level = 0; level < 7; ++level)
-                {
-                    for (size_t node = 0; node < node_num; ++node)
-                    {
-                        free(tree[level][node]);
-                    }
-                    free(tree[level]);
-                    node_num *= ary_num;
-                }
+            require_select(bv, target);
+            samples[target] = bv->select_samples[target];
+            sample_numbers[target] = bv->select_sample_number[target];
+        }
+        else
+        {
+            size_t target_num = target ? rank_one(bv, bv->length) : rank_zero(bv, bv->length);
+            sample_numbers[target] = (target_num + SELECT_SAMPLE_RATE - 1) / SELECT_SAMPLE_RATE;
+            samples[target] = malloc((sample_numbers[target] + 1) * sizeof(size_t));
+        }
+    }
+    if (bv->options.select_mode == SELECT_MODE_TREE)
+    {
+        size_t const counters[2] = {0, 0};
+        fill_positions(bv, 0, word_number(bv->length), counters, SELECT_SAMPLE_RATE, 0, samples);
+    }
 
-                // Remember we do not really allocate memory for bits in the 8th level,
-                // so we can just free the whole level.
-                free(tree[7]);
+    FileHeader header;
+    memset(&header, 0, sizeof(FileHeader));
+    strcpy(header.magic, FILE_MAGIC);
+    header.version = FILE_VERSION;
+    header.length = bv->length;
+    header.rank_layout = bv->options.rank_layout;
+    header.rank_block_length = bv->rank_block_length;
+    header.select_sample_number[0] = sample_numbers[0];
+    header.select_sample_number[1] = sample_numbers[1];
+
+    // Collect the sections, of which unused ones are empty.
+    void const *sections[5] = {bv->bits, NULL, NULL, samples[0], samples[1]};
+    size_t section_sizes[5];
+    get_section_sizes(&header, section_sizes);
+    if (bv->options.rank_layout == RANK_LAYOUT_INTERLEAVED)
+    {
+        sections[1] = bv->rank_interleaved;
+    }
+    else
+    {
+        sections[1] = bv->rank_blocks;
+        sections[2] = bv->rank_subblocks;
+    }
 
-                free(tree);
-            }
-        }
+    // Write a placeholder header first and the real one when all offsets are known.
+    uint64_t offset = 0;
+    bool ok = write_section(file, &header, sizeof(FileHeader), &offset);
+    for (size_t i = 0; ok && i < 5; ++i)
+    {
+        header.sections[i] = offset;
+        ok = write_section(file, sections[i], section_sizes[i], &offset);
+    }
+    header.file_size = offset;
+    ok = ok && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(FileHeader), 1, file) == 1;
+    ok = fclose(file) == 0 && ok;
 
-        free(bv->select_block_types[target]);
-        free(bv->select_blocks[target]);
-        free(bv->select_block_structures[target]);
+    if (bv->options.select_mode == SELECT_MODE_TREE)
+    {
+        free(samples[0]);
+        free(samples[1]);
     }
 
-    free(bv->select_block_types);
-    free(bv->select_blocks);
-    free(bv->select_block_structures);
+    if (!ok)
+    {
+        fprintf(stderr, "Error: Cannot write to `%s`.\n", path);
+    }
+    return ok;
 }
 
-size_t rank_one(BitVector *bv, size_t index)
+BitVector *map_bit_vector(char const *path)
 {
-    size_t rank = 0;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Error: Cannot open `%s` for reading.\n", path);
+        return NULL;
+    }
 
-    // Add ranks in previous blocks.
-    size_t block = index / bv->rank_block_length;
-    rank += bv->rank_blocks[block];
+    struct stat st;
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(FileHeader))
+    {
+        mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        fprintf(stderr, "Error: Cannot map `%s`.\n", path);
+        return NULL;
+    }
 
-    // Add ranks in previous subblocks.
-    size_t subblock = index / bv->rank_subblock_length;
-    rank += bv->rank_subblocks[subblock];
+    FileHeader const *header = mapping;
+    if (!check_header(header, st.st_size))
+    {
+        fprintf(stderr, "Error: `%s` is not a saved bit vector.\n", path);
+        munmap(mapping, st.st_size);
+        return NULL;
+    }
 
-    // Extract the remaining bit pattern.
-    size_t pattern = 0;
-    size_t start = subblock * bv->rank_subblock_length;
-    for (size_t i = 0; i < bv->rank_subblock_length; ++i)
+    // Point all structures into the mapping, which is never written through them.
+    uint8_t *base = mapping;
+    BitVector *bv = malloc(sizeof(BitVector));
+    memset(bv, 0, sizeof(BitVector));
+    bv->length = header->length;
+    bv->bits = (uint64_t const *)(base + header->sections[0]);
+    bv->owns_bits = false;
+    bv->mapping = mapping;
+    bv->mapping_size = st.st_size;
+    bv->options.rank_layout = header->rank_layout;
+    bv->options.select_mode = SELECT_MODE_SAMPLED;
+    bv->arena_number = 0;
+    bv->arenas = NULL;
+    bv->rank_block_length = header->rank_block_length;
+    if (bv->options.rank_layout == RANK_LAYOUT_INTERLEAVED)
     {
-        if (start + i < bv->length && is_bit_set(bv, start + i))
-        {
-            pattern += 1;
-        }
-        pattern <<= 1;
+        bv->rank_interleaved = (uint64_t *)(base + header->sections[1]);
     }
-    pattern >>= 1;
+    else
+    {
+        bv->rank_blocks = (size_t *)(base + header->sections[1]);
+        bv->rank_subblocks = (uint16_t *)(base + header->sections[2]);
+    }
+    for (size_t target = 0; target < 2; ++target)
+    {
+        bv->select_sample_number[target] = header->select_sample_number[target];
+        bv->select_samples[target] = (size_t *)(base + header->sections[3 + target]);
+        atomic_init(&bv->select_built[target], true);
+    }
+    pthread_mutex_init(&bv->select_mutex, NULL);
 
-    // Add ranks corresponding to the bit pattern.
-    index = fmod(index, bv->rank_subblock_length);
-    rank += bv->rank_subblock_table[pattern][index];
+    if (!check_sample_numbers(bv))
+    {
+        fprintf(stderr, "Error: `%s` is not a saved bit vector.\n", path);
+        destruct_bit_vector(bv);
+        return NULL;
+    }
+    return bv;
+}
 
-    return rank;
+size_t rank_one(BitVector const *bv, size_t index)
+{
+    bv = local_replica(bv);
+    if (bv->options.encoding != ENCODING_PLAIN)
+    {
+        return encoded_rank_one(bv, index);
+    }
+#ifdef HAS_X86_DISPATCH
+    if (cpu_has_popcnt())
+    {
+        return rank_plain_popcnt(bv, index);
+    }
+#endif
+    return rank_plain(bv, index);
 }
 
-size_t rank_zero(BitVector *bv, size_t index)
+size_t rank_zero(BitVector const *bv, size_t index)
 {
     return index - rank_one(bv, index);
 }
 
-size_t select_one(BitVector *bv, size_t index)
+void rank_one_batch(BitVector const *bv, size_t const *indexes, size_t n, size_t *ranks)
 {
-    return select_target(bv, index, 1);
+    bv = local_replica(bv);
+    if (bv->options.encoding != ENCODING_PLAIN)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            ranks[i] = encoded_rank_one(bv, indexes[i]);
+        }
+        return;
+    }
+
+#ifdef HAS_X86_DISPATCH
+    if (cpu_has_popcnt())
+    {
+        rank_plain_batch_popcnt(bv, indexes, n, ranks);
+        return;
+    }
+#endif
+    rank_plain_batch(bv, indexes, n, ranks);
 }
 
-size_t select_zero(BitVector *bv, size_t index)
+void rank_zero_batch(BitVector const *bv, size_t const *indexes, size_t n, size_t *ranks)
 {
-    return select_target(bv, index, 0);
+    rank_one_batch(bv, indexes, n, ranks);
+    for (size_t i = 0; i < n; ++i)
+    {
+        ranks[i] = indexes[i] - ranks[i];
+    }
 }
 
-/********** Definitions for Private Functions **********/
-
-static size_t select_target(BitVector *bv, size_t index, bool target)
+size_t rank_directory_size(BitVector const *bv)
 {
-    size_t block = index / bv->select_block_one_number;
-    index = fmod(index, bv->select_block_one_number);
-
-    if (bv->select_block_types[target][block])
+    if (bv->options.encoding == ENCODING_RRR)
     {
-        // Find a long block.
-        size_t *positions = bv->select_block_structures[target][block];
-        return positions[index];
+        return rrr_rank_directory_size(bv->rrr);
+    }
+    else if (bv->options.encoding == ENCODING_ELIAS_FANO)
+    {
+        return elias_fano_rank_directory_size(bv->ef);
+    }
+    else if (bv->options.encoding == ENCODING_RUN_LENGTH)
+    {
+        return run_length_rank_directory_size(bv->rl);
+    }
+    else if (bv->options.encoding == ENCODING_HYBRID)
+    {
+        return hybrid_rank_directory_size(bv->hybrid);
+    }
+    else if (bv->options.rank_layout == RANK_LAYOUT_INTERLEAVED)
+    {
+        size_t pair_num = bv->length / (INTERLEAVED_BLOCK_WORDS * WORD_BITS) + 1;
+        return pair_num * 2 * sizeof(uint64_t);
     }
     else
     {
-        // Find a short block.
+        size_t block_num = bv->length / bv->rank_block_length + 1;
+        size_t subblock_num = bv->length / WORD_BITS + 1;
+        return block_num * sizeof(size_t) + subblock_num * sizeof(uint16_t);
+    }
+}
 
-        // Add indexes from previous blocks.
-        size_t target_index = block ? bv->select_blocks[target][block - 1] : 0;
-        index = fmod(index, bv->select_block_one_number);
+size_t select_one(BitVector const *bv, size_t index)
+{
+    return select_target(bv, index, 1);
+}
 
-        // Go down to the 7th level of the tree to find the target bit index.
-        size_t ***tree = bv->select_block_structures[target][block];
-        size_t child = 0;
-        size_t sibling_num = 0;
-        size_t ary_num = sqrt(sqrt(bv->select_block_one_number));
-        for (size_t i = 0; i < 7; ++i)
-        {
-            size_t node = child + sibling_num * ary_num;
-            child = tree[i][node][index + 1];
-            sibling_num = node;
-        }
+size_t select_zero(BitVector const *bv, size_t index)
+{
+    return select_target(bv, index, 0);
+}
 
-        return target_index + child;
-    }
+void select_one_batch(BitVector const *bv, size_t const *indexes, size_t n, size_t *positions)
+{
+    select_target_batch(bv, indexes, n, positions, 1);
 }
 
-static void build_rank(BitVector *bv)
+void select_zero_batch(BitVector const *bv, size_t const *indexes, size_t n, size_t *positions)
 {
-    size_t lgn = ceil(log2(bv->length));
-    lgn = fmod(lgn, 2) ? lgn + 1 : lgn;
-    bv->rank_block_length = pow(lgn, 2);
-    bv->rank_subblock_length = lgn / 2;
-    bv->rank_blocks = malloc(bv->length / bv->rank_block_length * sizeof(size_t) + 1);
-    bv->rank_subblocks = malloc(bv->length / bv->rank_subblock_length * sizeof(size_t) + 1);
+    select_target_batch(bv, indexes, n, positions, 0);
+}
 
-    size_t counter = 0;
-    size_t sub_counter = 0;
-    for (size_t i = 0; i < bv->length; ++i)
+void push_back_bits(BitVector *bv, uint64_t word, size_t bit_number)
+{
+    size_t capacity = bv->options.append_capacity;
+    if (!capacity)
     {
-        if (!fmod(i, bv->rank_block_length))
-        {
-            // Find a block.
-            size_t block = i / bv->rank_block_length;
-            bv->rank_blocks[block] = counter;
-            counter = 0;
-        }
-
-        if (!fmod(i, bv->rank_subblock_length))
+        fprintf(stderr, "Error: Only bit vectors constructed with an append capacity can grow.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (bit_number > WORD_BITS || bv->length + bit_number > capacity)
+    {
+        fprintf(stderr, "Error: Appending %zu bits exceeds the capacity of %zu bits.\n", bit_number, capacity);
+        exit(EXIT_FAILURE);
+    }
+    if (!bit_number)
+    {
+        return;
+    }
+    word = bit_number < WORD_BITS ? word & (((uint64_t)1 << bit_number) - 1) : word;
+    for (size_t node = 0; node < bv->replica_number; ++node)
+    {
+        if (bv->replicas[node] != bv)
         {
-            // Find a subblock.
-            size_t subblock = i / bv->rank_subblock_length;
-            bv->rank_subblocks[subblock] = counter;
+            push_back_bits(bv->replicas[node], word, bit_number);
         }
+    }
 
-        if (is_bit_set(bv, i))
-        {
-            counter += 1;
-            sub_counter += 1;
-        }
+    // Commit space for the new bits and directory entries, including the spare word.
+    size_t old_length = bv->length;
+    size_t length = old_length + bit_number;
+    commit_region(bv->bits_region, (word_number(length) + 1) * sizeof(uint64_t));
+    if (bv->options.rank_layout == RANK_LAYOUT_INTERLEAVED)
+    {
+        size_t pair_num = length / (INTERLEAVED_BLOCK_WORDS * WORD_BITS) + 1;
+        commit_region(bv->rank_regions[0], pair_num * 2 * sizeof(uint64_t));
+    }
+    else
+    {
+        commit_region(bv->rank_regions[0], (length / bv->rank_block_length + 1) * sizeof(size_t));
+        commit_region(bv->rank_regions[1], (length / WORD_BITS + 1) * sizeof(uint16_t));
     }
 
-    // Build the final block.
-    if (!fmod(bv->length, bv->rank_block_length))
+    // Write the bits, keeping bits past the end 0.
+    uint64_t *bits = (uint64_t *)bv->bits;
+    size_t offset = old_length % WORD_BITS;
+    bits[old_length / WORD_BITS] |= word << offset;
+    if (offset && offset + bit_number > WORD_BITS)
     {
-        size_t block = bv->length / bv->rank_block_length;
-        bv->rank_blocks[block] = counter;
+        bits[old_length / WORD_BITS + 1] = word >> (WORD_BITS - offset);
     }
 
-    // Build the final subblock.
-    if (!fmod(bv->length, bv->rank_subblock_length))
+    // Add directory entries for the words starting in the new bits, from the rank of the word
+    // the new bits start in.
+    size_t first_word = old_length / WORD_BITS;
+    size_t rank = rank_one(bv, first_word * WORD_BITS);
+    size_t first_rank = rank;
+    bv->length = length;
+    for (size_t w = first_word + 1; w <= length / WORD_BITS; ++w)
     {
-        size_t subblock = bv->length / bv->rank_subblock_length;
-        bv->rank_subblocks[subblock] = sub_counter;
+        rank += __builtin_popcountll(bits[w - 1]);
+        set_rank_entry(bv, w, rank);
     }
 
-    // Build the table that maps ranks to pattern/index.
-    size_t pattern_num = pow(2, bv->rank_subblock_length);
-    bv->rank_subblock_table = malloc(pattern_num * sizeof(size_t *));
-    for (size_t pattern = 0; pattern < pattern_num; ++pattern)
+    // Extend the built select samples from the same word, rewriting samples before the new
+    // bits with the same positions.
+    size_t one_num = rank_one(bv, length);
+    size_t const counters[2] = {first_word * WORD_BITS - first_rank, first_rank};
+    size_t const target_nums[2] = {length - one_num, one_num};
+    size_t *positions[2] = {NULL, NULL};
+    for (size_t target = 0; target < 2; ++target)
+    {
+        if (atomic_load_explicit(&bv->select_built[target], memory_order_acquire))
+        {
+            size_t sample_num = (target_nums[target] + SELECT_SAMPLE_RATE - 1) / SELECT_SAMPLE_RATE;
+            commit_region(bv->select_regions[target], (sample_num + 1) * sizeof(size_t));
+            positions[target] = bv->select_samples[target];
+        }
+    }
+    fill_positions(bv, first_word, word_number(length), counters, SELECT_SAMPLE_RATE, 0, positions);
+    for (size_t target = 0; target < 2; ++target)
     {
-        size_t *pattern_index_map = malloc(bv->rank_subblock_length * sizeof(size_t));
-        size_t counter = 0;
-        for (size_t i = 0; i < bv->rank_subblock_length; ++i)
+        if (positions[target])
         {
-            counter += 1 & (pattern >> (bv->rank_subblock_length - i));
-            pattern_index_map[i] = counter;
+            bv->select_sample_number[target] = (target_nums[target] + SELECT_SAMPLE_RATE - 1) / SELECT_SAMPLE_RATE;
         }
-        bv->rank_subblock_table[pattern] = pattern_index_map;
     }
 }
 
-static void build_select(BitVector *bv, bool target)
+void build_select_structures(BitVector *bv)
 {
-    size_t sqrt_lgn = ceil(sqrt(log2(bv->length)));
-    bv->select_block_one_number = pow(sqrt_lgn, 4);
-    size_t block_length_boundary = pow(sqrt_lgn, 8);
-
-    size_t max_block_num = ceil(bv->length / (double)bv->select_block_one_number);
-    bv->select_block_types[target] = malloc(max_block_num * sizeof(bool));
-    bv->select_blocks[target] = malloc(max_block_num * sizeof(size_t));
-    bv->select_block_structures[target] = malloc(max_block_num * sizeof(void **));
+    require_select(bv, 0);
+    require_select(bv, 1);
+}
 
-    size_t counter = 0;
-    size_t block = 0;
-    size_t start = 0;
-    for (size_t i = 0; i < bv->length; ++i)
+BitVectorSpaceUsage bit_vector_space_usage(BitVector const *bv)
+{
+    BitVectorSpaceUsage usage;
+    memset(&usage, 0, sizeof(BitVectorSpaceUsage));
+    if (bv->options.encoding != ENCODING_PLAIN)
+    {
+        encoded_space_usage(bv, usage.bytes);
+        usage.bytes[SPACE_ALLOCATOR_OVERHEAD] += sizeof(BitVector);
+    }
+    else
     {
-        if (counter == bv->select_block_one_number)
+        plain_space_usage(bv, usage.bytes);
+        for (size_t node = 0; node < bv->replica_number; ++node)
         {
-            // Find a block.
-            bool block_type = i - start > block_length_boundary;
-            bv->select_block_types[target][block] = block_type;
-            bv->select_blocks[target][block] = i;
-            if (block_type)
-            {
-                // Find a long block.
-                size_t *positions = build_long_select_structure(bv, start, i);
-                bv->select_block_structures[target][block] = positions;
-            }
-            else
+            if (bv->replicas[node] != bv)
             {
-                // Find a short block.
-                size_t ***tree = build_short_select_structure(bv, start, i);
-                bv->select_block_structures[target][block] = tree;
+                size_t bytes[SPACE_COMPONENT_NUMBER];
+                plain_space_usage(bv->replicas[node], bytes);
+                for (size_t i = 0; i < SPACE_COMPONENT_NUMBER; ++i)
+                {
+                    usage.bytes[i] += bytes[i];
+                }
             }
-            counter = 0;
-            block += 1;
-            start = i;
         }
+    }
 
-        if (is_bit_set(bv, i))
-        {
-            counter += 1;
-        }
+    usage.total_bytes = 0;
+    for (size_t i = 0; i < SPACE_COMPONENT_NUMBER; ++i)
+    {
+        usage.total_bytes += usage.bytes[i];
+        usage.bits_per_bit[i] = bv->length ? 8.0 * usage.bytes[i] / bv->length : 0;
     }
+    usage.total_bits_per_bit = bv->length ? 8.0 * usage.total_bytes / bv->length : 0;
+    return usage;
+}
 
-    // Add the final block.
-    bool block_type = bv->length - start > block_length_boundary;
-    bv->select_block_types[target][block] = block_type;
-    bv->select_blocks[target][block] = bv->length;
-    if (block_type)
+/********** Definitions for Private Functions **********/
+
+static void build_structures(BitVector *bv, BitVectorOptions const *options)
+{
+    if (options)
     {
-        size_t *positions = build_long_select_structure(bv, start, bv->length);
-        bv->select_block_structures[target][block] = positions;
+        bv->options = *options;
     }
     else
     {
-        size_t ***tree = build_short_select_structure(bv, start, bv->length);
-        bv->select_block_structures[target][block] = tree;
+        memset(&bv->options, 0, sizeof(BitVectorOptions));
     }
 
-    // Record the number of blocks for proper destruction.
-    bv->select_block_number[target] = block + 1;
-}
-
-static size_t *build_long_select_structure(BitVector *bv, size_t start, size_t end)
-{
-    size_t *positions = malloc(bv->select_block_one_number * sizeof(size_t));
-    size_t *pos_ptr = positions;
-    for (size_t i = start; i < end; ++i)
+    bv->mapping = NULL;
+    bv->mapping_size = 0;
+    bv->rrr = NULL;
+    bv->ef = NULL;
+    bv->rl = NULL;
+    bv->hybrid = NULL;
+    bv->bits_region = NULL;
+    bv->rank_regions[0] = NULL;
+    bv->rank_regions[1] = NULL;
+    bv->select_regions[0] = NULL;
+    bv->select_regions[1] = NULL;
+    bv->replica_number = 0;
+    bv->replicas = NULL;
+    if (bv->options.append_capacity)
     {
-        if (is_bit_set(bv, i))
-        {
-            *pos_ptr++ = i;
-        }
+        init_appendable(bv);
     }
-    return positions;
-}
-
-static size_t ***build_short_select_structure(BitVector *bv, size_t start, size_t end)
-{
-    size_t block_length = pow(bv->select_block_one_number, 2);
-    size_t subblock_length = sqrt(bv->select_block_one_number);
-
-    // The tree structure has 8 levels.
-    size_t ***tree = malloc(8 * sizeof(size_t **));
-
-    // The 8th level is the original bits, padding with 0 to the length of (log2(n))^4.
-    // The `size_t *` type of each bit is only for type consistency.
-    size_t **bits = malloc(block_length * sizeof(size_t *));
-    for (size_t i = start; i < end; ++i)
+    if (bv->options.encoding != ENCODING_PLAIN)
     {
-        bits[i] = (size_t *)is_bit_set(bv, i);
+        encode_bits(bv);
+        return;
     }
-    tree[7] = bits;
 
-    // Other levels consist of a sqrt(log2(n))-ary tree.
-    // Each node is an array, whose first element is the number of ones and the remaining elements
-    // are child indexes for the query indexes that equal to the elements' indexes minus 1.
+    size_t thread_num = bv->options.thread_number > 1 ? bv->options.thread_number : 1;
+    bv->arena_number = thread_num;
+
+    // Use blocks of about (log2(n))^2 bits for rank, rounded up to whole words. Since log2(n)
+    // never exceeds 64, ranks relative to a block always fit in 16 bits.
+    size_t lgn = lg_length(bv);
+    size_t sqrt_lgn = ceil(sqrt(lgn));
+    bv->rank_block_length = (lgn * lgn + WORD_BITS - 1) / WORD_BITS * WORD_BITS;
+    bv->select_block_one_number = pow(sqrt_lgn, 4);
 
-    // We need to build the 7th level separately because it has log2(n) bit children.
-    size_t **level = malloc(block_length / subblock_length * sizeof(size_t *));
-    size_t *table = malloc((bv->select_block_one_number + 1) * sizeof(size_t));
+    // Count ones of every chunk and turn the counts into ranks of the chunks.
+    BuildContext context;
+    init_chunks(bv, &context);
+    run_parallel(thread_num, context.chunk_number, count_chunk_task, &context);
     size_t counter = 0;
-    size_t sub_counter = 0;
-    for (size_t i = 0; i < block_length; ++i)
+    for (size_t chunk = 0; chunk < context.chunk_number; ++chunk)
     {
-        if (i > 0 && !fmod(i, subblock_length))
-        {
-            // Find a subblock.
-            table[0] = sub_counter;
-            sub_counter = 0;
-            level[i / subblock_length - 1] = table;
-            table = malloc((bv->select_block_one_number + 1) * sizeof(size_t));
-        }
+        size_t one_num = context.chunk_ranks[chunk];
+        context.chunk_ranks[chunk] = counter;
+        counter += one_num;
+    }
+    context.chunk_ranks[context.chunk_number] = counter;
 
-        if (tree[7][i])
+    // Size the first arena for the rank directory and the eager select samples, which are
+    // known by now, so that they fill its first chunk. Select trees grow the arenas of the
+    // threads building them from about an eighth of their share of the bit string.
+    size_t first_chunk_size = 4096;
+    if (!bv->options.append_capacity)
+    {
+        first_chunk_size += rank_directory_size(bv);
+        if (bv->options.select_mode == SELECT_MODE_SAMPLED && !bv->options.lazy_select)
         {
-            table[counter + 1] = i;
-            ++counter;
-            ++sub_counter;
+            first_chunk_size += (bv->length / SELECT_SAMPLE_RATE + 4) * sizeof(size_t);
         }
     }
+    bv->arenas = malloc(thread_num * sizeof(Arena *));
+    bv->arenas[0] = construct_arena(first_chunk_size, bv->options.huge_pages);
+    for (size_t i = 1; i < thread_num; ++i)
+    {
+        bv->arenas[i] = construct_arena(bv->length / 64 / thread_num + 4096, bv->options.huge_pages);
+    }
+
+    // Allocate rank structures.
+    size_t subblock_num = bv->length / WORD_BITS + 1;
+    bv->rank_blocks = NULL;
+    bv->rank_subblocks = NULL;
+    bv->rank_interleaved = NULL;
+    if (bv->options.rank_layout == RANK_LAYOUT_INTERLEAVED)
+    {
+        // Align pairs to 16 bytes so that each of them sits in a single cache line.
+        size_t pair_num = bv->length / (INTERLEAVED_BLOCK_WORDS * WORD_BITS) + 1;
+        size_t reserved_pair_num = bv->options.append_capacity / (INTERLEAVED_BLOCK_WORDS * WORD_BITS) + 1;
+        bv->rank_interleaved = bv->options.append_capacity
+                                   ? growable_alloc(bv, &bv->rank_regions[0], pair_num * 2 * sizeof(uint64_t),
+                                                    reserved_pair_num * 2 * sizeof(uint64_t))
+                                   : arena_alloc(bv->arenas[0], pair_num * 2 * sizeof(uint64_t), 2 * sizeof(uint64_t));
+    }
+    else
+    {
+        size_t capacity = bv->options.append_capacity;
+        bv->rank_blocks = growable_alloc(bv, &bv->rank_regions[0], (bv->length / bv->rank_block_length + 1) * sizeof(size_t),
+                                         (capacity / bv->rank_block_length + 1) * sizeof(size_t));
+        bv->rank_subblocks = growable_alloc(bv, &bv->rank_regions[1], subblock_num * sizeof(uint16_t),
+                                            (capacity / WORD_BITS + 1) * sizeof(uint16_t));
+    }
+
+    // Allocate select structures unless they are built on first use.
+    if (bv->options.select_mode == SELECT_MODE_TREE)
+    {
+        bv->select_block_number = aux_alloc(bv, 2 * sizeof(size_t));
+        bv->select_block_types = aux_alloc(bv, 2 * sizeof(bool *));
+        bv->select_blocks = aux_alloc(bv, 2 * sizeof(size_t *));
+        bv->select_block_structures = aux_alloc(bv, 2 * sizeof(void **));
+    }
+    context.rank = true;
+    for (size_t target = 0; target < 2; ++target)
+    {
+        context.targets[target] = !bv->options.lazy_select;
+        if (context.targets[target])
+        {
+            allocate_select(bv, target, target ? counter : bv->length - counter);
+        }
+        atomic_init(&bv->select_built[target], context.targets[target]);
+    }
+    pthread_mutex_init(&bv->select_mutex, NULL);
+
+    // Build the rank directory and record select positions of both zeros and ones chunk by
+    // chunk, so that every chunk is read from memory once while all of them are built.
+    run_parallel(thread_num, context.chunk_number, build_chunk_task, &context);
+    build_select(&context);
+
+    free(context.chunk_ranks);
+
+    if (bv->options.numa_replicas)
+    {
+        replicate(bv);
+    }
+}
+
+static void encode_bits(BitVector *bv)
+{
+    // Encoded bit strings answer all queries by themselves, so the bits are dropped and no
+    // other structure is built.
+    if (bv->options.encoding == ENCODING_RRR)
+    {
+        size_t block_length = bv->options.rrr_block_length ? bv->options.rrr_block_length : MAX_RRR_BLOCK_LENGTH;
+        if (block_length > MAX_RRR_BLOCK_LENGTH)
+        {
+            fprintf(stderr, "Error: RRR blocks of %zu bits are longer than %d bits.\n", block_length,
+                    MAX_RRR_BLOCK_LENGTH);
+            exit(EXIT_FAILURE);
+        }
+        bv->rrr = construct_rrr_vector(bv->bits, bv->length, block_length);
+    }
+    else if (bv->options.encoding == ENCODING_ELIAS_FANO)
+    {
+        bv->ef = construct_elias_fano_vector_from_words(bv->bits, bv->length);
+    }
+    else if (bv->options.encoding == ENCODING_RUN_LENGTH)
+    {
+        bv->rl = construct_run_length_vector(bv->bits, bv->length);
+    }
+    else
+    {
+        bv->hybrid = construct_hybrid_vector(bv->bits, bv->length);
+    }
+
+    if (bv->owns_bits)
+    {
+        free_bits(bv);
+    }
+    bv->bits = NULL;
+    bv->owns_bits = false;
+    init_encoded(bv);
+}
+
+static void init_encoded(BitVector *bv)
+{
+    // Leave the structures of plain bit vectors empty, with nothing left to build lazily.
+    bv->arena_number = 0;
+    bv->arenas = NULL;
+    bv->rank_blocks = NULL;
+    bv->rank_subblocks = NULL;
+    bv->rank_interleaved = NULL;
+    bv->bits_region = NULL;
+    bv->rank_regions[0] = NULL;
+    bv->rank_regions[1] = NULL;
+    bv->select_regions[0] = NULL;
+    bv->select_regions[1] = NULL;
+    bv->replica_number = 0;
+    bv->replicas = NULL;
+    for (size_t target = 0; target < 2; ++target)
+    {
+        atomic_init(&bv->select_built[target], true);
+    }
+    pthread_mutex_init(&bv->select_mutex, NULL);
+}
+
+static void replicate(BitVector *bv)
+{
+    // Build every other replica on a thread of its node from our bits, so that its pages are
+    // allocated there on first touch, then ask the kernel to keep the memory mapped for each
+    // replica in place.
+    size_t node_num = bv_numa_node_number();
+    if (node_num <= 1)
+    {
+        return;
+    }
+    BitVectorOptions options = bv->options;
+    options.numa_replicas = false;
+    options.lazy_select = false;
+    size_t own_node = bv_numa_current_node() % node_num;
+    bv->replica_number = node_num;
+    bv->replicas = malloc(node_num * sizeof(BitVector *));
+    for (size_t node = 0; node < node_num; ++node)
+    {
+        if (node == own_node)
+        {
+            bv->replicas[node] = bv;
+            bind_to_node(bv, node);
+            continue;
+        }
+        ReplicaBuild build = {bv, &options, NULL};
+        bv_numa_run_on_node(node, build_replica, &build);
+        bv->replicas[node] = build.replica;
+        bind_to_node(build.replica, node);
+    }
+}
+
+static void build_replica(void *replica_build)
+{
+    ReplicaBuild *self = replica_build;
+    self->replica = construct_bit_vector_from_words_with_options(self->bv->bits, self->bv->length, false,
+                                                                 self->options);
+}
+
+static void bind_to_node(BitVector *bv, size_t node)
+{
+    // Only memory mapped for the bit vector alone can be bound, and bits from calloc stay
+    // where they were first touched.
+    if (bv->huge_bits_size)
+    {
+        bv_numa_bind(bv->bits, bv->huge_bits_size, node);
+    }
+    for (size_t i = 0; i < bv->arena_number; ++i)
+    {
+        arena_bind(bv->arenas[i], node);
+    }
+    Region *regions[] = {bv->bits_region, bv->rank_regions[0], bv->rank_regions[1], bv->select_regions[0],
+                         bv->select_regions[1]};
+    for (size_t i = 0; i < sizeof(regions) / sizeof(Region *); ++i)
+    {
+        if (regions[i])
+        {
+            region_bind(regions[i], node);
+        }
+    }
+}
+
+static BitVector const *local_replica(BitVector const *bv)
+{
+    if (!bv->replicas)
+    {
+        return bv;
+    }
+    return bv->replicas[bv_numa_current_node() % bv->replica_number];
+}
+
+static void check_positions(size_t const *positions, size_t n, size_t length)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (positions[i] >= length || (i && positions[i] <= positions[i - 1]))
+        {
+            fprintf(stderr, "Error: Positions must be strictly increasing and less than the length.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static inline size_t rank_plain(BitVector const *bv, size_t index)
+{
+    // Answer from the rank directory of a plain bit vector, compiled once for the hardware
+    // popcount instruction and once for any CPU.
+    size_t rank = 0;
+
+    if (bv->options.rank_layout == RANK_LAYOUT_INTERLEAVED)
+    {
+        // Add ranks in previous basic blocks and previous words of this basic block,
+        // both of which are in the same 16-byte pair.
+        size_t subblock = index / WORD_BITS;
+        uint64_t *pair = bv->rank_interleaved + 2 * (subblock / INTERLEAVED_BLOCK_WORDS);
+        size_t word = subblock % INTERLEAVED_BLOCK_WORDS;
+        rank += pair[0];
+        if (word)
+        {
+            rank += (pair[1] >> (word - 1) * INTERLEAVED_SUBBLOCK_BITS) & ((1 << INTERLEAVED_SUBBLOCK_BITS) - 1);
+        }
+
+        // Add ranks of the remaining bits in the final word.
+        size_t offset = index % WORD_BITS;
+        if (offset)
+        {
+            rank += __builtin_popcountll(bv->bits[subblock] & (((uint64_t)1 << offset) - 1));
+        }
+
+        return rank;
+    }
+
+    // Add ranks in previous blocks.
+    size_t block = index / bv->rank_block_length;
+    rank += bv->rank_blocks[block];
+
+    // Add ranks in previous subblocks.
+    size_t subblock = index / WORD_BITS;
+    rank += bv->rank_subblocks[subblock];
+
+    // Add ranks of the remaining bits in the final word.
+    size_t offset = index % WORD_BITS;
+    if (offset)
+    {
+        rank += __builtin_popcountll(bv->bits[subblock] & (((uint64_t)1 << offset) - 1));
+    }
+
+    return rank;
+}
+
+static inline void rank_plain_batch(BitVector const *bv, size_t const *indexes, size_t n, size_t *ranks)
+{
+    // Answer the queries of a plain bit vector in a software pipeline, prefetching the lines of
+    // the query `RANK_PREFETCH_DISTANCE` places ahead while answering the current one.
+    size_t const distance = RANK_PREFETCH_DISTANCE;
+    if (bv->options.rank_layout == RANK_LAYOUT_INTERLEAVED)
+    {
+        // The pair and the word of a query are independent, so both are prefetched at once.
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (i + distance < n)
+            {
+                size_t subblock = indexes[i + distance] / WORD_BITS;
+                __builtin_prefetch(bv->rank_interleaved + 2 * (subblock / INTERLEAVED_BLOCK_WORDS));
+                __builtin_prefetch(bv->bits + subblock);
+            }
+            ranks[i] = rank_plain(bv, indexes[i]);
+        }
+        return;
+    }
+
+    // The separate layout takes three lines per query, so sum the block and subblock ranks of
+    // all queries first and add the ranks in the final words in a second pass, keeping fewer
+    // lines in flight per query in each.
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (i + distance < n)
+        {
+            size_t index = indexes[i + distance];
+            __builtin_prefetch(bv->rank_blocks + index / bv->rank_block_length);
+            __builtin_prefetch(bv->rank_subblocks + index / WORD_BITS);
+        }
+        size_t index = indexes[i];
+        ranks[i] = bv->rank_blocks[index / bv->rank_block_length] + bv->rank_subblocks[index / WORD_BITS];
+    }
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (i + distance < n)
+        {
+            __builtin_prefetch(bv->bits + indexes[i + distance] / WORD_BITS);
+        }
+        size_t offset = indexes[i] % WORD_BITS;
+        if (offset)
+        {
+            ranks[i] += __builtin_popcountll(bv->bits[indexes[i] / WORD_BITS] & (((uint64_t)1 << offset) - 1));
+        }
+    }
+}
+
+static size_t encoded_rank_one(BitVector const *bv, size_t index)
+{
+    if (bv->options.encoding == ENCODING_RRR)
+    {
+        return rrr_rank_one(bv->rrr, index);
+    }
+    else if (bv->options.encoding == ENCODING_ELIAS_FANO)
+    {
+        return elias_fano_rank_one(bv->ef, index);
+    }
+    else if (bv->options.encoding == ENCODING_RUN_LENGTH)
+    {
+        return run_length_rank_one(bv->rl, index);
+    }
+    return hybrid_rank_one(bv->hybrid, index);
+}
+
+static size_t encoded_select(BitVector const *bv, size_t index, bool target)
+{
+    if (bv->options.encoding == ENCODING_RRR)
+    {
+        return rrr_select(bv->rrr, index, target);
+    }
+    else if (bv->options.encoding == ENCODING_ELIAS_FANO)
+    {
+        return elias_fano_select(bv->ef, index, target);
+    }
+    else if (bv->options.encoding == ENCODING_RUN_LENGTH)
+    {
+        return run_length_select(bv->rl, index, target);
+    }
+    return hybrid_select(bv->hybrid, index, target);
+}
+
+static void encoded_space_usage(BitVector const *bv, size_t *bytes)
+{
+    if (bv->options.encoding == ENCODING_RRR)
+    {
+        rrr_space_usage(bv->rrr, bytes);
+    }
+    else if (bv->options.encoding == ENCODING_ELIAS_FANO)
+    {
+        elias_fano_space_usage(bv->ef, bytes);
+    }
+    else if (bv->options.encoding == ENCODING_RUN_LENGTH)
+    {
+        run_length_space_usage(bv->rl, bytes);
+    }
+    else
+    {
+        hybrid_space_usage(bv->hybrid, bytes);
+    }
+}
+
+static void plain_space_usage(BitVector const *bv, size_t *bytes)
+{
+    bytes[SPACE_PAYLOAD] = word_number(bv->length) * sizeof(uint64_t);
+    if (bv->options.rank_layout == RANK_LAYOUT_INTERLEAVED)
+    {
+        size_t pair_num = bv->length / (INTERLEAVED_BLOCK_WORDS * WORD_BITS) + 1;
+        bytes[SPACE_RANK_BLOCKS] = pair_num * sizeof(uint64_t);
+        bytes[SPACE_RANK_SUBBLOCKS] = pair_num * sizeof(uint64_t);
+    }
+    else
+    {
+        bytes[SPACE_RANK_BLOCKS] = (bv->length / bv->rank_block_length + 1) * sizeof(size_t);
+        bytes[SPACE_RANK_SUBBLOCKS] = (bv->length / WORD_BITS + 1) * sizeof(uint16_t);
+    }
+
+    // Hold the lock so that no select structure is half built while walking it. The lock is
+    // not part of the value of the bit vector, so it is taken on const ones as well.
+    pthread_mutex_t *select_mutex = (pthread_mutex_t *)&bv->select_mutex;
+    pthread_mutex_lock(select_mutex);
+    bytes[SPACE_SELECT_ONE] = select_space(bv, 1);
+    bytes[SPACE_SELECT_ZERO] = select_space(bv, 0);
+
+    // Everything else held by the arenas or the mapping is overhead.
+    size_t held = sizeof(BitVector) + bv->arena_number * sizeof(Arena *) + bv->replica_number * sizeof(BitVector *);
+    if (bv->mapping)
+    {
+        held += bv->mapping_size;
+    }
+    else
+    {
+        // Borrowed bits are not held by the bit vector but still used by it, while the bits
+        // of appendable bit vectors are held by their region and bits in huge pages take up
+        // whole huge pages.
+        held += bv->bits_region      ? 0
+                : bv->huge_bits_size ? huge_page_round(bv->huge_bits_size)
+                                     : bytes[SPACE_PAYLOAD];
+        Region *regions[] = {bv->bits_region, bv->rank_regions[0], bv->rank_regions[1], bv->select_regions[0],
+                             bv->select_regions[1]};
+        for (size_t i = 0; i < sizeof(regions) / sizeof(Region *); ++i)
+        {
+            held += regions[i] ? region_size(regions[i]) : 0;
+        }
+        for (size_t i = 0; i < bv->arena_number; ++i)
+        {
+            held += arena_size(bv->arenas[i]);
+        }
+    }
+    pthread_mutex_unlock(select_mutex);
+
+    size_t used = 0;
+    for (size_t i = 0; i < SPACE_ALLOCATOR_OVERHEAD; ++i)
+    {
+        used += bytes[i];
+    }
+    bytes[SPACE_ALLOCATOR_OVERHEAD] = held > used ? held - used : 0;
+}
+
+static void init_chunks(BitVector *bv, BuildContext *context)
+{
+    // Chunks consist of whole rank blocks and interleaved pairs, and `chunk_ranks` is left
+    // for the caller to fill.
+    context->bv = bv;
+    size_t subblock_num = bv->length / WORD_BITS + 1;
+    size_t block_words = bv->rank_block_length / WORD_BITS;
+    size_t unit = block_words;
+    while (unit % INTERLEAVED_BLOCK_WORDS)
+    {
+        unit += block_words;
+    }
+    size_t chunk_words = subblock_num / (bv->arena_number * BUILD_CHUNKS_PER_THREAD);
+    context->chunk_words = chunk_words > unit ? (chunk_words + unit - 1) / unit * unit : unit;
+    context->chunk_number = (subblock_num + context->chunk_words - 1) / context->chunk_words;
+    context->chunk_ranks = malloc((context->chunk_number + 1) * sizeof(size_t));
+}
+
+static void allocate_select(BitVector *bv, bool target, size_t target_num)
+{
+    // The sizes of select structures follow from the number of target bits.
+    if (bv->options.select_mode == SELECT_MODE_SAMPLED)
+    {
+        bv->select_sample_number[target] = (target_num + SELECT_SAMPLE_RATE - 1) / SELECT_SAMPLE_RATE;
+        size_t reserved_num = bv->options.append_capacity / SELECT_SAMPLE_RATE + 1;
+        bv->select_samples[target] = growable_alloc(bv, &bv->select_regions[target],
+                                                    (bv->select_sample_number[target] + 1) * sizeof(size_t),
+                                                    (reserved_num + 1) * sizeof(size_t));
+    }
+    else
+    {
+        size_t block_num = target_num / bv->select_block_one_number + 1;
+        bv->select_block_number[target] = block_num;
+        bv->select_block_types[target] = aux_alloc(bv, block_num * sizeof(bool));
+        bv->select_blocks[target] = aux_alloc(bv, block_num * sizeof(size_t));
+        bv->select_block_structures[target] = aux_alloc(bv, block_num * sizeof(void *));
+    }
+}
+
+static void require_select(BitVector const *bv, bool target)
+{
+    // Double-checked locking, so that queries on built structures only pay for one load.
+    if (atomic_load_explicit(&bv->select_built[target], memory_order_acquire))
+    {
+        return;
+    }
+
+    // Deferred structures are the only state that queries change, once and behind the lock,
+    // and bit vectors are never allocated as const objects, so they may be modified here.
+    BitVector *mutable_bv = (BitVector *)bv;
+    pthread_mutex_lock(&mutable_bv->select_mutex);
+    if (!atomic_load_explicit(&bv->select_built[target], memory_order_relaxed))
+    {
+        build_lazy_select(mutable_bv, target);
+        atomic_store_explicit(&mutable_bv->select_built[target], true, memory_order_release);
+    }
+    pthread_mutex_unlock(&mutable_bv->select_mutex);
+}
+
+static void build_lazy_select(BitVector *bv, bool target)
+{
+    // Take ranks of the chunks from the rank directory, which is already built.
+    BuildContext context;
+    init_chunks(bv, &context);
+    for (size_t chunk = 0; chunk <= context.chunk_number; ++chunk)
+    {
+        size_t start = chunk * context.chunk_words * WORD_BITS;
+        context.chunk_ranks[chunk] = rank_one(bv, start < bv->length ? start : bv->length);
+    }
+    context.rank = false;
+    context.targets[0] = !target;
+    context.targets[1] = target;
+
+    size_t one_num = context.chunk_ranks[context.chunk_number];
+    allocate_select(bv, target, target ? one_num : bv->length - one_num);
+    run_parallel(bv->arena_number, context.chunk_number, build_chunk_task, &context);
+    build_select(&context);
+
+    free(context.chunk_ranks);
+}
+
+static void prefetch_rank(BitVector const *bv, size_t index)
+{
+    // Prefetch every line that `rank_one` reads for `index`.
+    size_t subblock = index / WORD_BITS;
+    if (bv->options.rank_layout == RANK_LAYOUT_INTERLEAVED)
+    {
+        __builtin_prefetch(bv->rank_interleaved + 2 * (subblock / INTERLEAVED_BLOCK_WORDS));
+    }
+    else
+    {
+        __builtin_prefetch(bv->rank_blocks + index / bv->rank_block_length);
+        __builtin_prefetch(bv->rank_subblocks + subblock);
+    }
+    __builtin_prefetch(bv->bits + subblock);
+}
+
+static size_t select_target(BitVector const *bv, size_t index, bool target)
+{
+    bv = local_replica(bv);
+    if (bv->options.encoding != ENCODING_PLAIN)
+    {
+        return encoded_select(bv, index, target);
+    }
+
+    require_select(bv, target);
+    if (bv->options.select_mode == SELECT_MODE_SAMPLED)
+    {
+        return select_sampled_target(bv, index, target);
+    }
+
+    size_t block = index / bv->select_block_one_number;
+    index %= bv->select_block_one_number;
+
+    if (bv->select_block_types[target][block])
+    {
+        // Find a long block.
+        size_t *positions = bv->select_block_structures[target][block];
+        return positions[index];
+    }
+    else
+    {
+        // Find a short block.
+
+        // Add indexes from previous blocks.
+        size_t target_index = block ? bv->select_blocks[target][block - 1] : 0;
+
+        // Go down to the 7th level of the tree to find the leaf containing the target bit,
+        // turning the index into a local one of each child on the way.
+        size_t subblock_length = sqrt(bv->select_block_one_number);
+        size_t ***tree = bv->select_block_structures[target][block];
+        size_t node = 0;
+        size_t ary_num = sqrt(sqrt(bv->select_block_one_number));
+        for (size_t i = 0; i < 6; ++i)
+        {
+            size_t const *table = tree[i][node];
+            size_t child = table[1 + ary_num + index];
+            index -= table[1 + child];
+            node = node * ary_num + child;
+        }
+
+        // Finish in the bits of the leaf.
+        size_t leaf_start = target_index + node * subblock_length;
+        uint64_t leaf = get_bits(bv, leaf_start, subblock_length);
+        leaf = target ? leaf : ~leaf;
+        return leaf_start + select_in_word(leaf, index);
+    }
+}
+
+static size_t select_sampled_target(BitVector const *bv, size_t index, bool target)
+{
+    // Jump to the nearest sample before the target bit.
+    // Clamp the bounds to the bits, since samples of mapped files are not checked.
+    size_t sample = index / SELECT_SAMPLE_RATE;
+    size_t last = (bv->length - 1) / WORD_BITS;
+    size_t high = sample + 1 < bv->select_sample_number[target]
+                      ? bv->select_samples[target][sample + 1] / WORD_BITS
+                      : last;
+    high = high < last ? high : last;
+    size_t low = bv->select_samples[target][sample] / WORD_BITS;
+    low = low < high ? low : high;
+
+    // Binary search the rank directory for the last word starting with fewer target bits
+    // than `index`, which is the word containing the target bit.
+    while (low < high)
+    {
+        size_t middle = low + (high - low + 1) / 2;
+        size_t rank = target ? rank_one(bv, middle * WORD_BITS) : rank_zero(bv, middle * WORD_BITS);
+        if (rank <= index)
+        {
+            low = middle;
+        }
+        else
+        {
+            high = middle - 1;
+        }
+    }
+
+    // Finish in the word.
+    size_t rank = target ? rank_one(bv, low * WORD_BITS) : rank_zero(bv, low * WORD_BITS);
+    uint64_t word = target ? get_word(bv, low) : ~get_word(bv, low);
+    return low * WORD_BITS + select_in_word(word, index - rank);
+}
+
+static void select_target_batch(BitVector const *bv, size_t const *indexes, size_t n, size_t *positions, bool target)
+{
+    bv = local_replica(bv);
+    if (bv->options.encoding != ENCODING_PLAIN)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            positions[i] = encoded_select(bv, indexes[i], target);
+        }
+        return;
+    }
+
+    require_select(bv, target);
+    for (size_t start = 0; start < n; start += BATCH_GROUP_SIZE)
+    {
+        size_t group_size = n - start < BATCH_GROUP_SIZE ? n - start : BATCH_GROUP_SIZE;
+        if (bv->options.select_mode == SELECT_MODE_SAMPLED)
+        {
+            select_sampled_group(bv, indexes + start, group_size, positions + start, target);
+        }
+        else
+        {
+            select_tree_group(bv, indexes + start, group_size, positions + start, target);
+        }
+    }
+}
+
+static void select_tree_group(BitVector const *bv, size_t const *indexes, size_t n, size_t *positions, bool target)
+{
+    // Move all queries of the group down the trees one step at a time. Every step only reads
+    // lines that the previous step prefetched for it, which arrive while the other queries
+    // of the group are being advanced. Locating a block takes two steps and every level two
+    // more, one to load the table of the node and one to read its child and offset.
+    bool const *types = bv->select_block_types[target];
+    void *const *structures = bv->select_block_structures[target];
+    size_t const *ends = bv->select_blocks[target];
+    size_t *long_positions[BATCH_GROUP_SIZE];
+    size_t ***trees[BATCH_GROUP_SIZE];
+    size_t const *tables[BATCH_GROUP_SIZE];
+    size_t starts[BATCH_GROUP_SIZE];
+    size_t nodes[BATCH_GROUP_SIZE];
+    size_t locals[BATCH_GROUP_SIZE];
+    size_t subblock_length = sqrt(bv->select_block_one_number);
+    size_t ary_num = sqrt(subblock_length);
+
+    for (size_t q = 0; q < n; ++q)
+    {
+        size_t block = indexes[q] / bv->select_block_one_number;
+        __builtin_prefetch(types + block);
+        __builtin_prefetch(structures + block);
+        __builtin_prefetch(ends + block - (block > 0));
+    }
+
+    for (size_t q = 0; q < n; ++q)
+    {
+        size_t block = indexes[q] / bv->select_block_one_number;
+        locals[q] = indexes[q] % bv->select_block_one_number;
+        nodes[q] = 0;
+        if (types[block])
+        {
+            // Long blocks are answered directly, so mark them with no tree.
+            trees[q] = NULL;
+            long_positions[q] = structures[block];
+            __builtin_prefetch(long_positions[q] + locals[q]);
+        }
+        else
+        {
+            trees[q] = structures[block];
+            starts[q] = block ? ends[block - 1] : 0;
+            __builtin_prefetch(trees[q]);
+        }
+    }
+
+    for (size_t q = 0; q < n; ++q)
+    {
+        if (trees[q])
+        {
+            __builtin_prefetch(trees[q][0]);
+        }
+    }
+
+    for (size_t i = 0; i < 6; ++i)
+    {
+        for (size_t q = 0; q < n; ++q)
+        {
+            if (trees[q])
+            {
+                tables[q] = trees[q][i][nodes[q]];
+                __builtin_prefetch(tables[q]);
+                __builtin_prefetch(tables[q] + 1 + ary_num + locals[q]);
+            }
+        }
+
+        for (size_t q = 0; q < n; ++q)
+        {
+            if (trees[q])
+            {
+                size_t child = tables[q][1 + ary_num + locals[q]];
+                locals[q] -= tables[q][1 + child];
+                nodes[q] = nodes[q] * ary_num + child;
+                if (i < 5)
+                {
+                    __builtin_prefetch(trees[q][i + 1] + nodes[q]);
+                }
+                else
+                {
+                    __builtin_prefetch(bv->bits + (starts[q] + nodes[q] * subblock_length) / WORD_BITS);
+                }
+            }
+        }
+    }
+
+    for (size_t q = 0; q < n; ++q)
+    {
+        if (trees[q])
+        {
+            // Finish in the bits of the leaf.
+            size_t leaf_start = starts[q] + nodes[q] * subblock_length;
+            uint64_t leaf = get_bits(bv, leaf_start, subblock_length);
+            leaf = target ? leaf : ~leaf;
+            positions[q] = leaf_start + select_in_word(leaf, locals[q]);
+        }
+        else
+        {
+            positions[q] = long_positions[q][locals[q]];
+        }
+    }
+}
+
+static void select_sampled_group(BitVector const *bv, size_t const *indexes, size_t n, size_t *positions, bool target)
+{
+    // Run the binary searches of all queries of the group in lockstep, prefetching the
+    // rank directory lines of every probe before any of them is read.
+    size_t lows[BATCH_GROUP_SIZE];
+    size_t highs[BATCH_GROUP_SIZE];
+    size_t *samples = bv->select_samples[target];
+    size_t last = (bv->length - 1) / WORD_BITS;
+
+    for (size_t q = 0; q < n; ++q)
+    {
+        __builtin_prefetch(samples + indexes[q] / SELECT_SAMPLE_RATE);
+    }
+    for (size_t q = 0; q < n; ++q)
+    {
+        size_t sample = indexes[q] / SELECT_SAMPLE_RATE;
+        size_t high = sample + 1 < bv->select_sample_number[target] ? samples[sample + 1] / WORD_BITS : last;
+        size_t low = samples[sample] / WORD_BITS;
+        highs[q] = high < last ? high : last;
+        lows[q] = low < highs[q] ? low : highs[q];
+    }
+
+    bool searching = true;
+    while (searching)
+    {
+        for (size_t q = 0; q < n; ++q)
+        {
+            if (lows[q] < highs[q])
+            {
+                prefetch_rank(bv, (lows[q] + (highs[q] - lows[q] + 1) / 2) * WORD_BITS);
+            }
+        }
+
+        searching = false;
+        for (size_t q = 0; q < n; ++q)
+        {
+            if (lows[q] < highs[q])
+            {
+                size_t middle = lows[q] + (highs[q] - lows[q] + 1) / 2;
+                size_t rank = target ? rank_one(bv, middle * WORD_BITS) : rank_zero(bv, middle * WORD_BITS);
+                if (rank <= indexes[q])
+                {
+                    lows[q] = middle;
+                }
+                else
+                {
+                    highs[q] = middle - 1;
+                }
+                searching = searching || lows[q] < highs[q];
+            }
+        }
+    }
+
+    for (size_t q = 0; q < n; ++q)
+    {
+        prefetch_rank(bv, lows[q] * WORD_BITS);
+    }
+    for (size_t q = 0; q < n; ++q)
+    {
+        // Finish in the word.
+        size_t rank = target ? rank_one(bv, lows[q] * WORD_BITS) : rank_zero(bv, lows[q] * WORD_BITS);
+        uint64_t word = target ? get_word(bv, lows[q]) : ~get_word(bv, lows[q]);
+        positions[q] = lows[q] * WORD_BITS + select_in_word(word, indexes[q] - rank);
+    }
+}
+
+static void build_select(BuildContext *context)
+{
+    // Chunk tasks only record sampled positions and the positions of block ends, so build
+    // the blocks of select trees of both targets here, every one of which is independent
+    // of the others.
+    BitVector *bv = context->bv;
+    if (bv->options.select_mode == SELECT_MODE_TREE)
+    {
+        size_t task_num = 0;
+        for (size_t target = 0; target < 2; ++target)
+        {
+            if (!context->targets[target])
+            {
+                continue;
+            }
+            size_t block_num = bv->select_block_number[target];
+            task_num += block_num;
+            for (size_t block = 0; block + 1 < block_num; ++block)
+            {
+                // Blocks end right after their last target bit.
+                bv->select_blocks[target][block] += 1;
+            }
+            bv->select_blocks[target][block_num - 1] = bv->length;
+        }
+        run_parallel(bv->arena_number, task_num, select_block_task, context);
+    }
+}
+
+static void count_chunk_task(void *context, size_t chunk, size_t thread)
+{
+    // Chunks need no memory of their own, so the thread running them does not matter.
+    (void)thread;
+#ifdef HAS_X86_DISPATCH
+    if (cpu_has_popcnt())
+    {
+        count_chunk_popcnt(context, chunk);
+        return;
+    }
+#endif
+    count_chunk(context, chunk);
+}
+
+static void build_chunk_task(void *context, size_t chunk, size_t thread)
+{
+    (void)thread;
+#ifdef HAS_X86_DISPATCH
+    if (cpu_has_popcnt())
+    {
+        build_chunk_popcnt(context, chunk);
+        return;
+    }
+#endif
+    build_chunk(context, chunk);
+}
+
+static inline void count_chunk(BuildContext *build, size_t chunk)
+{
+    // Counting and building loops are compiled once for the hardware popcount instruction
+    // and once for any CPU, like `rank_plain`.
+    BitVector *bv = build->bv;
+    size_t word_num = word_number(bv->length);
+    size_t first_word = chunk * build->chunk_words;
+    size_t last_word = first_word + build->chunk_words < word_num ? first_word + build->chunk_words : word_num;
+
+    size_t counter = 0;
+    for (size_t w = first_word; w < last_word; ++w)
+    {
+        counter += __builtin_popcountll(get_word(bv, w));
+    }
+    build->chunk_ranks[chunk] = counter;
+}
+
+static inline void build_chunk(BuildContext *build, size_t chunk)
+{
+    BitVector *bv = build->bv;
+    if (build->rank && bv->options.rank_layout == RANK_LAYOUT_INTERLEAVED)
+    {
+        build_interleaved_rank_chunk(build, chunk);
+    }
+    else if (build->rank)
+    {
+        build_rank_chunk(build, chunk);
+    }
+
+    // Chunk ranks count ones, and zeros follow from the number of bits before the chunk.
+    size_t word_num = word_number(bv->length);
+    size_t first_word = chunk * build->chunk_words;
+    size_t last_word = first_word + build->chunk_words < word_num ? first_word + build->chunk_words : word_num;
+    if (first_word >= last_word)
+    {
+        return;
+    }
+    size_t const counters[2] = {first_word * WORD_BITS - build->chunk_ranks[chunk], build->chunk_ranks[chunk]};
+
+    if (bv->options.select_mode == SELECT_MODE_SAMPLED)
+    {
+        size_t *const positions[2] = {build->targets[0] ? bv->select_samples[0] : NULL,
+                                      build->targets[1] ? bv->select_samples[1] : NULL};
+        fill_positions(bv, first_word, last_word, counters, SELECT_SAMPLE_RATE, 0, positions);
+    }
+    else
+    {
+        // Record the last target bit of every block.
+        size_t rate = bv->select_block_one_number;
+        size_t *const positions[2] = {build->targets[0] ? bv->select_blocks[0] : NULL,
+                                      build->targets[1] ? bv->select_blocks[1] : NULL};
+        fill_positions(bv, first_word, last_word, counters, rate, rate - 1, positions);
+    }
+}
+
+static void select_block_task(void *context, size_t task, size_t thread)
+{
+    // Tasks cover the blocks of select_0 first and then those of select_1, for the targets
+    // being built.
+    BuildContext *build = context;
+    BitVector *bv = build->bv;
+    size_t zero_block_num = build->targets[0] ? bv->select_block_number[0] : 0;
+    bool target = task >= zero_block_num;
+    size_t block = task - (target ? zero_block_num : 0);
+    size_t sqrt_lgn = ceil(sqrt(lg_length(bv)));
+    size_t block_length_boundary = pow(sqrt_lgn, 8);
+
+    size_t start = block ? bv->select_blocks[target][block - 1] : 0;
+    size_t end = bv->select_blocks[target][block];
+    bool block_type = end - start > block_length_boundary;
+    bv->select_block_types[target][block] = block_type;
+    if (block_type)
+    {
+        // Find a long block.
+        size_t *positions = build_long_select_structure(bv, bv->arenas[thread], target, start, end);
+        bv->select_block_structures[target][block] = positions;
+    }
+    else
+    {
+        // Find a short block.
+        size_t ***tree = build_short_select_structure(bv, bv->arenas[thread], target, start, end);
+        bv->select_block_structures[target][block] = tree;
+    }
+}
 
-    //Add the final subblock.
-    table[0] = sub_counter;
-    level[block_length / subblock_length - 1] = table;
-    tree[6] = level;
-
-    // Build remaining levels.
-    size_t ary_num = sqrt(sqrt(bv->select_block_one_number));
-    size_t child_num = pow(sqrt(bv->select_block_one_number), 3);
-    size_t node_num = child_num / ary_num;
-    for (size_t i = 0; i < 6; ++i)
+static inline void build_rank_chunk(BuildContext *context, size_t chunk)
+{
+    BitVector *bv = context->bv;
+    size_t subblock_num = bv->length / WORD_BITS + 1;
+    size_t first_subblock = chunk * context->chunk_words;
+    size_t last_subblock = first_subblock + context->chunk_words < subblock_num
+                               ? first_subblock + context->chunk_words
+                               : subblock_num;
+
+    // Chunks start at blocks, so the first subblock always starts a block.
+    size_t counter = context->chunk_ranks[chunk];
+    size_t sub_counter = 0;
+    size_t word_num = word_number(bv->length);
+    for (size_t subblock = first_subblock; subblock < last_subblock; ++subblock)
     {
-        size_t **level = malloc(node_num * sizeof(size_t *));
-        size_t *table = malloc((bv->select_block_one_number + 1) * sizeof(size_t));
-        size_t counter = 0;
+        size_t start = subblock * WORD_BITS;
+        if (!(start % bv->rank_block_length))
+        {
+            // Find a block.
+            bv->rank_blocks[start / bv->rank_block_length] = counter;
+            sub_counter = 0;
+        }
+        bv->rank_subblocks[subblock] = sub_counter;
+
+        if (subblock < word_num)
+        {
+            size_t one_num = __builtin_popcountll(get_word(bv, subblock));
+            counter += one_num;
+            sub_counter += one_num;
+        }
+    }
+}
+
+static inline void build_interleaved_rank_chunk(BuildContext *context, size_t chunk)
+{
+    BitVector *bv = context->bv;
+    size_t pair_num = bv->length / (INTERLEAVED_BLOCK_WORDS * WORD_BITS) + 1;
+    size_t chunk_pairs = context->chunk_words / INTERLEAVED_BLOCK_WORDS;
+    size_t first_pair = chunk * chunk_pairs;
+    size_t last_pair = first_pair + chunk_pairs < pair_num ? first_pair + chunk_pairs : pair_num;
+
+    size_t counter = context->chunk_ranks[chunk];
+    size_t word_num = word_number(bv->length);
+    for (size_t pair = first_pair; pair < last_pair; ++pair)
+    {
+        uint64_t subblocks = 0;
         size_t sub_counter = 0;
-        for (size_t child = 0; child < child_num; ++child)
+        bv->rank_interleaved[2 * pair] = counter;
+        for (size_t i = 0; i < INTERLEAVED_BLOCK_WORDS; ++i)
         {
-            if (child > 0 && !fmod(child, ary_num))
+            size_t word = pair * INTERLEAVED_BLOCK_WORDS + i;
+            if (i)
+            {
+                subblocks |= (uint64_t)sub_counter << (i - 1) * INTERLEAVED_SUBBLOCK_BITS;
+            }
+            if (word < word_num)
             {
-                // Finish processing all children of one node.
-                table[0] = sub_counter;
-                sub_counter = 0;
-                level[child / ary_num - 1] = table;
-                table = malloc((bv->select_block_one_number + 1) * sizeof(size_t));
+                size_t one_num = __builtin_popcountll(get_word(bv, word));
+                counter += one_num;
+                sub_counter += one_num;
             }
+        }
+        bv->rank_interleaved[2 * pair + 1] = subblocks;
+    }
+}
 
-            // Process one child.
-            size_t one_num = tree[(5 - i) + 1][child][0];
-            for (size_t j = 0; j < one_num; ++j)
+static inline void fill_positions(BitVector const *bv, size_t first_word, size_t last_word, size_t const *counters,
+                                  size_t rate, size_t offset, size_t *const *positions)
+{
+    // Record the position of every unset bit in `positions[0]` and of every set bit in
+    // `positions[1]`, whose index `i` among the bits of its kind satisfies `i % rate == offset`,
+    // at index `i / rate`. Words from `first_word` to `last_word - 1` are scanned once for both
+    // kinds, and `counters` holds the indexes of their first unset and set bits. A kind whose
+    // `positions` is NULL is skipped.
+    size_t counter[2] = {counters[0], counters[1]};
+    size_t next[2];
+    for (size_t target = 0; target < 2; ++target)
+    {
+        next[target] = counter[target] / rate * rate + offset;
+        next[target] = next[target] < counter[target] ? next[target] + rate : next[target];
+    }
+    for (size_t w = first_word; w < last_word; ++w)
+    {
+        // Zeros are read from the complemented word, without bits past the end.
+        size_t bit_num = bv->length - w * WORD_BITS < WORD_BITS ? bv->length - w * WORD_BITS : WORD_BITS;
+        uint64_t words[2];
+        words[1] = get_word(bv, w);
+        words[0] = bit_num < WORD_BITS ? ~words[1] & (((uint64_t)1 << bit_num) - 1) : ~words[1];
+        size_t one_num = __builtin_popcountll(words[1]);
+        size_t const nums[2] = {bit_num - one_num, one_num};
+
+        // Only look into words that contain a recorded bit.
+        for (size_t target = 0; target < 2; ++target)
+        {
+            while (positions[target] && counter[target] + nums[target] > next[target])
             {
-                table[counter + j + 1] = fmod(child, ary_num);
-                ++sub_counter;
+                positions[target][next[target] / rate] =
+                    w * WORD_BITS + select_in_word(words[target], next[target] - counter[target]);
+                next[target] += rate;
             }
-            counter += one_num;
+            counter[target] += nums[target];
+        }
+    }
+}
+
+static bool write_section(FILE *file, void const *data, size_t size, uint64_t *offset)
+{
+    // Write `size` bytes of `data` followed by zeros up to the next aligned offset.
+    static uint8_t const padding[FILE_ALIGNMENT] = {0};
+    size_t padding_size = (FILE_ALIGNMENT - size % FILE_ALIGNMENT) % FILE_ALIGNMENT;
+    if ((size && fwrite(data, size, 1, file) != 1) || (padding_size && fwrite(padding, padding_size, 1, file) != 1))
+    {
+        return false;
+    }
+    *offset += size + padding_size;
+    return true;
+}
+
+static void get_section_sizes(FileHeader const *header, size_t *sizes)
+{
+    sizes[0] = word_number(header->length) * sizeof(uint64_t);
+    sizes[1] = 0;
+    sizes[2] = 0;
+    if (header->rank_layout == RANK_LAYOUT_INTERLEAVED)
+    {
+        sizes[1] = (header->length / (INTERLEAVED_BLOCK_WORDS * WORD_BITS) + 1) * 2 * sizeof(uint64_t);
+    }
+    else
+    {
+        sizes[1] = (header->length / header->rank_block_length + 1) * sizeof(size_t);
+        sizes[2] = (header->length / WORD_BITS + 1) * sizeof(uint16_t);
+    }
+    sizes[3] = header->select_sample_number[0] * sizeof(size_t);
+    sizes[4] = header->select_sample_number[1] * sizeof(size_t);
+}
+
+static bool check_header(FileHeader const *header, size_t file_size)
+{
+    // Check everything the structures are pointed into the file with, so that truncated or
+    // corrupt files are rejected instead of being read out of bounds.
+    if (memcmp(header->magic, FILE_MAGIC, sizeof(FILE_MAGIC)) || header->version != FILE_VERSION ||
+        header->file_size != file_size)
+    {
+        return false;
+    }
+    if ((header->rank_layout != RANK_LAYOUT_SEPARATE && header->rank_layout != RANK_LAYOUT_INTERLEAVED) ||
+        !header->rank_block_length || header->rank_block_length % WORD_BITS)
+    {
+        return false;
+    }
+
+    // Bound the counts by the file size first, so that the section sizes cannot overflow.
+    if (header->length / 8 > file_size || header->select_sample_number[0] > file_size / sizeof(size_t) ||
+        header->select_sample_number[1] > file_size / sizeof(size_t))
+    {
+        return false;
+    }
+    size_t sizes[5];
+    get_section_sizes(header, sizes);
+    for (size_t i = 0; i < 5; ++i)
+    {
+        uint64_t offset = header->sections[i];
+        if (offset % FILE_ALIGNMENT || offset < sizeof(FileHeader) || offset > file_size ||
+            sizes[i] > file_size - offset)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool check_sample_numbers(BitVector const *bv)
+{
+    // There must be a sample for every valid select index, which only takes the total
+    // number of ones. The samples themselves are not read, so that mapping stays O(1), and
+    // select queries keep their searches within the bits instead.
+    size_t one_num = rank_one(bv, bv->length);
+    if (one_num > bv->length)
+    {
+        return false;
+    }
+    size_t const target_nums[2] = {bv->length - one_num, one_num};
+    for (size_t target = 0; target < 2; ++target)
+    {
+        if (bv->select_sample_number[target] != (target_nums[target] + SELECT_SAMPLE_RATE - 1) / SELECT_SAMPLE_RATE)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static size_t *build_long_select_structure(BitVector *bv, Arena *arena, bool target, size_t start, size_t end)
+{
+    size_t *positions = arena_alloc(arena, bv->select_block_one_number * sizeof(size_t), sizeof(size_t));
+    size_t *pos_ptr = positions;
+    for (size_t i = start; i < end; i += WORD_BITS)
+    {
+        uint64_t word = get_target_bits(bv, target, i, end - i < WORD_BITS ? end - i : WORD_BITS);
+        while (word)
+        {
+            *pos_ptr++ = i + __builtin_ctzll(word);
+            word &= word - 1;
         }
+    }
+    return positions;
+}
+
+static size_t ***build_short_select_structure(BitVector *bv, Arena *arena, bool target, size_t start,
+                                              size_t end)
+{
+    size_t ary_num = sqrt(sqrt(bv->select_block_one_number));
+    size_t subblock_length = ary_num * ary_num;
+    size_t node_nums[7];
+    count_tree_nodes(bv, start, end, node_nums);
+
+    // The tree structure has 7 levels of a sqrt(log2(n))-ary tree over the bits of the block,
+    // whose leaves are subblocks of log2(n) bits. Only nodes that cover the block are built.
+    // Each node is an array, whose first element is the number of ones, followed by the numbers
+    // of ones in the children before each child and then by the child index of every query
+    // index, so that a query never reads the tables of the siblings it passes over.
+    size_t ***tree = arena_alloc(arena, 7 * sizeof(size_t **), sizeof(size_t));
+
+    // We need to build the 7th level separately because it only records the number of ones.
+    // Queries finish with an in-word select on the subblock, which never exceeds 64 bits.
+    size_t **level = arena_alloc(arena, node_nums[6] * sizeof(size_t *), sizeof(size_t));
+    for (size_t node = 0; node < node_nums[6]; ++node)
+    {
+        size_t sub_start = start + node * subblock_length;
+        size_t sub_length = end - sub_start < subblock_length ? end - sub_start : subblock_length;
+        size_t *table = arena_alloc(arena, sizeof(size_t), sizeof(size_t));
+        table[0] = __builtin_popcountll(get_target_bits(bv, target, sub_start, sub_length));
+        level[node] = table;
+    }
+    tree[6] = level;
 
-        // Add the final node.
-        table[0] = sub_counter;
-        level[node_num - 1] = table;
+    // Build remaining levels.
+    for (size_t i = 0; i < 6; ++i)
+    {
+        size_t **children = tree[(5 - i) + 1];
+        size_t child_num = node_nums[(5 - i) + 1];
+        size_t **level = arena_alloc(arena, node_nums[5 - i] * sizeof(size_t *), sizeof(size_t));
+        for (size_t node = 0; node < node_nums[5 - i]; ++node)
+        {
+            // Count ones of all children of this node first to size its table.
+            size_t first_child = node * ary_num;
+            size_t last_child = first_child + ary_num < child_num ? first_child + ary_num : child_num;
+            size_t one_num = 0;
+            for (size_t child = first_child; child < last_child; ++child)
+            {
+                one_num += children[child][0];
+            }
 
+            size_t *table = arena_alloc(arena, (1 + ary_num + one_num) * sizeof(size_t), sizeof(size_t));
+            size_t *offsets = table + 1;
+            size_t *child_indexes = table + 1 + ary_num;
+            size_t counter = 0;
+            for (size_t child = first_child; child < first_child + ary_num; ++child)
+            {
+                offsets[child - first_child] = counter;
+                for (size_t j = 0; child < last_child && j < children[child][0]; ++j)
+                {
+                    child_indexes[counter++] = child - first_child;
+                }
+            }
+            table[0] = counter;
+            level[node] = table;
+        }
         tree[5 - i] = level;
-        child_num /= ary_num;
-        node_num /= ary_num;
     }
 
     return tree;
 }
 
-static void find_bit(BitVector *bv, size_t index, uint8_t **byte, uint8_t *mask)
+static void count_tree_nodes(BitVector const *bv, size_t start, size_t end, size_t *node_nums)
+{
+    size_t ary_num = sqrt(sqrt(bv->select_block_one_number));
+    size_t subblock_length = ary_num * ary_num;
+    node_nums[6] = end > start ? (end - start + subblock_length - 1) / subblock_length : 1;
+    for (size_t i = 6; i > 0; --i)
+    {
+        node_nums[i - 1] = (node_nums[i] + ary_num - 1) / ary_num;
+    }
+}
+
+static size_t select_space(BitVector const *bv, bool target)
+{
+    if (!atomic_load_explicit(&bv->select_built[target], memory_order_acquire))
+    {
+        return 0;
+    }
+    if (bv->options.select_mode == SELECT_MODE_SAMPLED)
+    {
+        return (bv->select_sample_number[target] + (bv->mapping ? 0 : 1)) * sizeof(size_t);
+    }
+
+    // Every block has a type, an end and a structure, which is either an array of positions
+    // or a tree whose nodes are tables of a count, child offsets and child indexes.
+    size_t ary_num = sqrt(sqrt(bv->select_block_one_number));
+    size_t block_num = bv->select_block_number[target];
+    size_t space = block_num * (sizeof(bool) + sizeof(size_t) + sizeof(void *));
+    for (size_t block = 0; block < block_num; ++block)
+    {
+        if (bv->select_block_types[target][block])
+        {
+            space += bv->select_block_one_number * sizeof(size_t);
+            continue;
+        }
+        size_t start = block ? bv->select_blocks[target][block - 1] : 0;
+        size_t end = bv->select_blocks[target][block];
+        size_t node_nums[7];
+        count_tree_nodes(bv, start, end, node_nums);
+        size_t ***tree = bv->select_block_structures[target][block];
+        space += 7 * sizeof(size_t **);
+        for (size_t level = 0; level < 7; ++level)
+        {
+            space += node_nums[level] * sizeof(size_t *);
+            for (size_t node = 0; node < node_nums[level]; ++node)
+            {
+                space += (level < 6 ? 1 + ary_num + tree[level][node][0] : 1) * sizeof(size_t);
+            }
+        }
+    }
+    return space;
+}
+
+static void *aux_alloc(BitVector *bv, size_t size)
+{
+    return arena_alloc(bv->arenas[0], size, sizeof(size_t));
+}
+
+static uint64_t *alloc_bits(BitVector *bv, size_t word_num, BitVectorOptions const *options)
+{
+    // Only the bits of plain bit vectors are kept, and appendable ones move theirs into a
+    // region, so the bits of all others are zero-filled by calloc.
+    bool huge = options && options->huge_pages && options->encoding == ENCODING_PLAIN && !options->append_capacity;
+    uint64_t *bits = huge ? huge_page_alloc(word_num * sizeof(uint64_t)) : NULL;
+    bv->huge_bits_size = bits ? word_num * sizeof(uint64_t) : 0;
+    return bits ? bits : calloc(word_num, sizeof(uint64_t));
+}
+
+static void free_bits(BitVector *bv)
+{
+    if (bv->huge_bits_size)
+    {
+        huge_page_free((void *)bv->bits, bv->huge_bits_size);
+    }
+    else
+    {
+        free((void *)bv->bits);
+    }
+    bv->huge_bits_size = 0;
+}
+
+static void *growable_alloc(BitVector *bv, Region **region, size_t size, size_t reserved_size)
+{
+    // Structures of appendable bit vectors are reserved up to the capacity and grow in place.
+    if (!bv->options.append_capacity)
+    {
+        return aux_alloc(bv, size);
+    }
+    *region = construct_region(reserved_size, bv->options.huge_pages);
+    if (!*region)
+    {
+        fprintf(stderr, "Error: Cannot reserve %zu bytes for an appendable bit vector.\n", reserved_size);
+        exit(EXIT_FAILURE);
+    }
+    commit_region(*region, size);
+    return region_data(*region);
+}
+
+static void init_appendable(BitVector *bv)
+{
+    if (bv->options.encoding != ENCODING_PLAIN || bv->options.select_mode != SELECT_MODE_SAMPLED)
+    {
+        fprintf(stderr, "Error: Appendable bit vectors must use `ENCODING_PLAIN` and `SELECT_MODE_SAMPLED`.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (bv->options.append_capacity < bv->length)
+    {
+        bv->options.append_capacity = bv->length;
+    }
+
+    // Move the bits into a region with a spare word, so that appends may write past the end.
+    size_t word_num = word_number(bv->length);
+    uint64_t *bits = growable_alloc(bv, &bv->bits_region, (word_num + 1) * sizeof(uint64_t),
+                                    (word_number(bv->options.append_capacity) + 1) * sizeof(uint64_t));
+    memcpy(bits, bv->bits, word_num * sizeof(uint64_t));
+    if (bv->length % WORD_BITS)
+    {
+        bits[word_num - 1] &= ((uint64_t)1 << (bv->length % WORD_BITS)) - 1;
+    }
+    if (bv->owns_bits)
+    {
+        free_bits(bv);
+    }
+    bv->bits = bits;
+    bv->owns_bits = false;
+}
+
+static void commit_region(Region *region, size_t size)
+{
+    if (!region_commit(region, size))
+    {
+        fprintf(stderr, "Error: Cannot commit %zu bytes for an appendable bit vector.\n", size);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void set_rank_entry(BitVector *bv, size_t word, size_t rank)
+{
+    // Record `rank` ones before `word` in the rank directory.
+    if (bv->options.rank_layout == RANK_LAYOUT_INTERLEAVED)
+    {
+        uint64_t *pair = bv->rank_interleaved + 2 * (word / INTERLEAVED_BLOCK_WORDS);
+        size_t i = word % INTERLEAVED_BLOCK_WORDS;
+        if (!i)
+        {
+            pair[0] = rank;
+            pair[1] = 0;
+        }
+        else
+        {
+            // Construction fills the fields of words past the end too, so replace the field.
+            size_t shift = (i - 1) * INTERLEAVED_SUBBLOCK_BITS;
+            pair[1] &= ~((((uint64_t)1 << INTERLEAVED_SUBBLOCK_BITS) - 1) << shift);
+            pair[1] |= (uint64_t)(rank - pair[0]) << shift;
+        }
+        return;
+    }
+
+    size_t start = word * WORD_BITS;
+    if (!(start % bv->rank_block_length))
+    {
+        bv->rank_blocks[start / bv->rank_block_length] = rank;
+    }
+    bv->rank_subblocks[word] = rank - bv->rank_blocks[start / bv->rank_block_length];
+}
+
+static size_t lg_length(BitVector const *bv)
+{
+    // Always use at least 2 to keep blocks and subblocks non-empty for tiny bit strings.
+    // Appendable bit vectors size blocks for their capacity, since they keep them as they grow.
+    size_t length = bv->length > bv->options.append_capacity ? bv->length : bv->options.append_capacity;
+    return length > 4 ? ceil(log2(length)) : 2;
+}
+
+static size_t parse_bits_str(char const *bits_str, size_t str_length, uint64_t *words)
+{
+    // Classify the characters in blocks of 64, then append the ones of the data characters
+    // to `words`, which must be zeroed and hold at least `str_length` bits. Returns the
+    // number of bits parsed.
+    size_t length = 0;
+    for (size_t start = 0; start < str_length; start += PARSE_BLOCK_CHARS)
+    {
+        size_t char_number = str_length - start;
+        uint64_t ones = 0;
+        uint64_t data = 0;
+        uint64_t separators = 0;
+        if (char_number >= PARSE_BLOCK_CHARS)
+        {
+            char_number = PARSE_BLOCK_CHARS;
+            classify_chars(bits_str + start, &ones, &data, &separators);
+        }
+        else
+        {
+            classify_chars_scalar(bits_str + start, char_number, &ones, &data, &separators);
+        }
+
+        uint64_t valid = data | separators;
+        uint64_t expected = char_number < WORD_BITS ? ((uint64_t)1 << char_number) - 1 : ~(uint64_t)0;
+        if (valid != expected)
+        {
+            char c = bits_str[start + __builtin_ctzll(~valid)];
+            fprintf(stderr, "Error: Unknown character `%c` in the input bit string.\n", c);
+            exit(EXIT_FAILURE);
+        }
+
+        // Drop the separators, then append the remaining bits at the end of `words`.
+        size_t bit_number = __builtin_popcountll(data);
+        uint64_t bits = separators ? compress_bits(ones, data) : ones;
+        if (!bit_number)
+        {
+            continue;
+        }
+        size_t word = length / WORD_BITS;
+        size_t offset = length % WORD_BITS;
+        words[word] |= bits << offset;
+        if (offset + bit_number > WORD_BITS)
+        {
+            words[word + 1] |= bits >> (WORD_BITS - offset);
+        }
+        length += bit_number;
+    }
+    return length;
+}
+
+static void classify_chars(char const *chars, uint64_t *ones, uint64_t *data, uint64_t *separators)
+{
+    // Build the masks of '1', of '0' or '1', and of '_' or ' ' over 64 characters.
+#ifdef HAS_X86_DISPATCH
+    if (cpu_has_avx2())
+    {
+        classify_chars_avx2(chars, ones, data, separators);
+        return;
+    }
+#endif
+#ifdef __SSE2__
+    classify_chars_sse2(chars, ones, data, separators);
+#else
+    classify_chars_scalar(chars, PARSE_BLOCK_CHARS, ones, data, separators);
+#endif
+}
+
+static void classify_chars_scalar(char const *chars, size_t char_number, uint64_t *ones, uint64_t *data,
+                                  uint64_t *separators)
+{
+    *ones = 0;
+    *data = 0;
+    *separators = 0;
+    for (size_t i = 0; i < char_number; ++i)
+    {
+        uint64_t bit = (uint64_t)1 << i;
+        if (chars[i] == '1')
+        {
+            *ones |= bit;
+            *data |= bit;
+        }
+        else if (chars[i] == '0')
+        {
+            *data |= bit;
+        }
+        else if (chars[i] == '_' || chars[i] == ' ')
+        {
+            *separators |= bit;
+        }
+    }
+}
+
+#ifdef __SSE2__
+static void classify_chars_sse2(char const *chars, uint64_t *ones, uint64_t *data, uint64_t *separators)
+{
+    // Characters '0' and '1' differ only in their lowest bit, so clearing it turns
+    // one comparison into a test for both.
+    __m128i const zero = _mm_set1_epi8('0');
+    __m128i const one = _mm_set1_epi8('1');
+    __m128i const underscore = _mm_set1_epi8('_');
+    __m128i const space = _mm_set1_epi8(' ');
+    __m128i const low_bit = _mm_set1_epi8(1);
+    *ones = 0;
+    *data = 0;
+    *separators = 0;
+    for (size_t i = 0; i < PARSE_BLOCK_CHARS; i += 16)
+    {
+        __m128i block = _mm_loadu_si128((__m128i const *)(chars + i));
+        __m128i is_one = _mm_cmpeq_epi8(block, one);
+        __m128i is_data = _mm_cmpeq_epi8(_mm_andnot_si128(low_bit, block), zero);
+        __m128i is_separator = _mm_or_si128(_mm_cmpeq_epi8(block, underscore), _mm_cmpeq_epi8(block, space));
+        *ones |= (uint64_t)(uint16_t)_mm_movemask_epi8(is_one) << i;
+        *data |= (uint64_t)(uint16_t)_mm_movemask_epi8(is_data) << i;
+        *separators |= (uint64_t)(uint16_t)_mm_movemask_epi8(is_separator) << i;
+    }
+}
+#endif
+
+#ifdef HAS_X86_DISPATCH
+static void classify_chars_avx2(char const *chars, uint64_t *ones, uint64_t *data, uint64_t *separators)
+{
+    __m256i const zero = _mm256_set1_epi8('0');
+    __m256i const one = _mm256_set1_epi8('1');
+    __m256i const underscore = _mm256_set1_epi8('_');
+    __m256i const space = _mm256_set1_epi8(' ');
+    __m256i const low_bit = _mm256_set1_epi8(1);
+    *ones = 0;
+    *data = 0;
+    *separators = 0;
+    for (size_t i = 0; i < PARSE_BLOCK_CHARS; i += 32)
+    {
+        __m256i block = _mm256_loadu_si256((__m256i const *)(chars + i));
+        __m256i is_one = _mm256_cmpeq_epi8(block, one);
+        __m256i is_data = _mm256_cmpeq_epi8(_mm256_andnot_si256(low_bit, block), zero);
+        __m256i is_separator =
+            _mm256_or_si256(_mm256_cmpeq_epi8(block, underscore), _mm256_cmpeq_epi8(block, space));
+        *ones |= (uint64_t)(uint32_t)_mm256_movemask_epi8(is_one) << i;
+        *data |= (uint64_t)(uint32_t)_mm256_movemask_epi8(is_data) << i;
+        *separators |= (uint64_t)(uint32_t)_mm256_movemask_epi8(is_separator) << i;
+    }
+}
+
+static uint64_t compress_bits_bmi2(uint64_t value, uint64_t mask)
+{
+    return _pext_u64(value, mask);
+}
+
+static size_t rank_plain_popcnt(BitVector const *bv, size_t index)
+{
+    return rank_plain(bv, index);
+}
+
+static void rank_plain_batch_popcnt(BitVector const *bv, size_t const *indexes, size_t n, size_t *ranks)
+{
+    rank_plain_batch(bv, indexes, n, ranks);
+}
+
+static void count_chunk_popcnt(BuildContext *context, size_t chunk)
+{
+    count_chunk(context, chunk);
+}
+
+static void build_chunk_popcnt(BuildContext *context, size_t chunk)
+{
+    build_chunk(context, chunk);
+}
+#endif
+
+static uint64_t compress_bits(uint64_t value, uint64_t mask)
+{
+    // Gather the bits of `value` selected by `mask` into the low bits of the result.
+#ifdef HAS_X86_DISPATCH
+    if (cpu_has_bmi2())
+    {
+        return compress_bits_bmi2(value, mask);
+    }
+#endif
+    uint64_t result = 0;
+    for (size_t i = 0; mask; ++i)
+    {
+        result |= ((value >> __builtin_ctzll(mask)) & 1) << i;
+        mask &= mask - 1;
+    }
+    return result;
+}
+
+static uint64_t get_word(BitVector const *bv, size_t word)
 {
-    size_t byte_num = index / 8;
-    index = fmod(index, 8);
-    *byte = bv->bits + byte_num;
-    *mask = 128 >> index;
+    // Bits past the end of the bit string are always read as 0.
+    uint64_t value = bv->bits[word];
+    size_t tail = bv->length - word * WORD_BITS;
+    return tail < WORD_BITS ? value & (((uint64_t)1 << tail) - 1) : value;
 }
 
-static bool is_bit_set(BitVector *bv, size_t index)
+static uint64_t get_bits(BitVector const *bv, size_t start, size_t length)
 {
-    uint8_t *byte = NULL;
-    uint8_t mask = 0;
-    find_bit(bv, index, &byte, &mask);
-    return *byte & mask;
+    // Extract at most 64 bits starting from `start`, with bits past the end read as 0.
+    return read_bits(bv->bits, bv->length, start, length);
 }
 
-static void set_bit(BitVector *bv, size_t index)
+static uint64_t get_target_bits(BitVector const *bv, bool target, size_t start, size_t length)
 {
-    uint8_t *byte = NULL;
-    uint8_t mask = 0;
-    find_bit(bv, index, &byte, &mask);
-    *byte |= mask;
+    // Extract at most 64 bits like `get_bits`, complemented when the target bits are zeros.
+    uint64_t value = get_bits(bv, start, length);
+    if (!target)
+    {
+        value = ~value;
+        if (length < WORD_BITS)
+        {
+            value &= ((uint64_t)1 << length) - 1;
+        }
+    }
+    return value;
 }
@@ -0,0 +1,614 @@
+#include "../include/bit_vector.h"
+#include "word.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+#define WORD_BITS 64
+
+// Leaves hold up to this many words of bits and inner nodes up to this many children, each
+// with room for one more insertion before they split in half.
+#define LEAF_WORDS 32
+#define LEAF_BITS (LEAF_WORDS * WORD_BITS)
+#define FANOUT 16
+
+// Nodes are merged with or refilled from a sibling once they drop below a quarter full, and
+// bulk construction fills them three quarters so that neither splits nor merges follow soon.
+#define MIN_LEAF_BITS (LEAF_BITS / 4)
+#define MIN_FANOUT (FANOUT / 4)
+#define BULK_LEAF_BITS (LEAF_BITS * 3 / 4)
+#define BULK_FANOUT (FANOUT * 3 / 4)
+
+// Bounds the depth of the tree, whose nodes other than the root have at least 4 children.
+#define MAX_DEPTH 64
+
+typedef enum Update
+{
+    UPDATE_SET,
+    UPDATE_CLEAR,
+    UPDATE_FLIP,
+} Update;
+
+// Leaves and inner nodes start with this header, where `size` is the number of bits of a
+// leaf or the number of children of an inner node.
+typedef struct Node
+{
+    bool leaf;
+    size_t size;
+} Node;
+
+typedef struct Leaf
+{
+    Node node;
+    // Bits past `size` are always 0.
+    uint64_t words[LEAF_WORDS + 1];
+} Leaf;
+
+typedef struct Inner
+{
+    Node node;
+    size_t bits[FANOUT + 1];
+    size_t ones[FANOUT + 1];
+    Node *children[FANOUT + 1];
+} Inner;
+
+/********** Declarations of Private Functions **********/
+
+static Node *construct_leaf(void);
+static Node *construct_inner(void);
+static void destruct_node(Node *node);
+static void count_node(Node *node, size_t *bits, size_t *ones);
+static size_t select_target(DynamicBitVector const *dbv, size_t index, bool target);
+static void update_bit(DynamicBitVector *dbv, size_t index, Update update);
+static Node *insert_node(Node *node, size_t index, bool bit);
+static bool delete_node(Node *node, size_t index);
+static Node *split_node(Node *node);
+static void rebalance(Inner *inner, size_t child);
+static void remove_child(Inner *inner, size_t child);
+static bool is_underfull(Node *node);
+static void leaf_insert(Leaf *leaf, size_t index, bool bit);
+static bool leaf_delete(Leaf *leaf, size_t index);
+static void append_bits(uint64_t *words, size_t length, uint64_t const *source, size_t start, size_t count);
+static void clear_tail(uint64_t *words, size_t length, size_t word_number);
+static void check_index(DynamicBitVector const *dbv, size_t index, size_t limit);
+
+/********** Definitions of `DynamicBitVector` and Public Functions **********/
+
+struct DynamicBitVector
+{
+    size_t length;
+    Node *root;
+};
+
+DynamicBitVector *construct_dynamic_bit_vector(void)
+{
+    DynamicBitVector *dbv = malloc(sizeof(DynamicBitVector));
+    dbv->length = 0;
+    dbv->root = construct_leaf();
+    return dbv;
+}
+
+DynamicBitVector *construct_dynamic_bit_vector_from_words(uint64_t const *words, size_t length)
+{
+    // Fill leaves from the words, then build inner levels bottom-up, spreading the children
+    // of every level evenly over its nodes.
+    size_t node_num = length ? (length + BULK_LEAF_BITS - 1) / BULK_LEAF_BITS : 1;
+    Node **nodes = malloc(node_num * sizeof(Node *));
+    for (size_t i = 0; i < node_num; ++i)
+    {
+        size_t start = i * BULK_LEAF_BITS;
+        size_t count = length - start < BULK_LEAF_BITS ? length - start : BULK_LEAF_BITS;
+        nodes[i] = construct_leaf();
+        append_bits(((Leaf *)nodes[i])->words, 0, words, start, length ? count : 0);
+        nodes[i]->size = length ? count : 0;
+    }
+    while (node_num > 1)
+    {
+        size_t parent_num = (node_num + BULK_FANOUT - 1) / BULK_FANOUT;
+        size_t child = 0;
+        for (size_t i = 0; i < parent_num; ++i)
+        {
+            Inner *inner = (Inner *)construct_inner();
+            inner->node.size = node_num / parent_num + (i < node_num % parent_num);
+            for (size_t c = 0; c < inner->node.size; ++c)
+            {
+                inner->children[c] = nodes[child++];
+                count_node(inner->children[c], &inner->bits[c], &inner->ones[c]);
+            }
+            nodes[i] = &inner->node;
+        }
+        node_num = parent_num;
+    }
+
+    DynamicBitVector *dbv = malloc(sizeof(DynamicBitVector));
+    dbv->length = length;
+    dbv->root = nodes[0];
+    free(nodes);
+    return dbv;
+}
+
+void destruct_dynamic_bit_vector(DynamicBitVector *dbv)
+{
+    destruct_node(dbv->root);
+    free(dbv);
+}
+
+size_t dynamic_length(DynamicBitVector const *dbv)
+{
+    return dbv->length;
+}
+
+bool dynamic_get_bit(DynamicBitVector const *dbv, size_t index)
+{
+    check_index(dbv, index, dbv->length);
+    Node *node = dbv->root;
+    while (!node->leaf)
+    {
+        Inner *inner = (Inner *)node;
+        size_t c = 0;
+        while (index >= inner->bits[c])
+        {
+            index -= inner->bits[c++];
+        }
+        node = inner->children[c];
+    }
+    return ((Leaf *)node)->words[index / WORD_BITS] >> (index % WORD_BITS) & 1;
+}
+
+void dynamic_insert_bit(DynamicBitVector *dbv, size_t index, bool bit)
+{
+    // Grow a new root above the old one when it splits.
+    check_index(dbv, index, dbv->length + 1);
+    Node *sibling = insert_node(dbv->root, index, bit);
+    if (sibling)
+    {
+        Inner *root = (Inner *)construct_inner();
+        root->node.size = 2;
+        root->children[0] = dbv->root;
+        root->children[1] = sibling;
+        count_node(dbv->root, &root->bits[0], &root->ones[0]);
+        count_node(sibling, &root->bits[1], &root->ones[1]);
+        dbv->root = &root->node;
+    }
+    ++dbv->length;
+}
+
+bool dynamic_delete_bit(DynamicBitVector *dbv, size_t index)
+{
+    // Drop roots left with a single child.
+    check_index(dbv, index, dbv->length);
+    bool bit = delete_node(dbv->root, index);
+    while (!dbv->root->leaf && dbv->root->size == 1)
+    {
+        Node *root = dbv->root;
+        dbv->root = ((Inner *)root)->children[0];
+        free(root);
+    }
+    --dbv->length;
+    return bit;
+}
+
+void dynamic_set_bit(DynamicBitVector *dbv, size_t index)
+{
+    update_bit(dbv, index, UPDATE_SET);
+}
+
+void dynamic_clear_bit(DynamicBitVector *dbv, size_t index)
+{
+    update_bit(dbv, index, UPDATE_CLEAR);
+}
+
+void dynamic_flip_bit(DynamicBitVector *dbv, size_t index)
+{
+    update_bit(dbv, index, UPDATE_FLIP);
+}
+
+size_t dynamic_rank_one(DynamicBitVector const *dbv, size_t index)
+{
+    // Add ones of children left of the path, then those of the leaf before `index`.
+    index = index < dbv->length ? index : dbv->length;
+    size_t rank = 0;
+    Node *node = dbv->root;
+    while (!node->leaf)
+    {
+        Inner *inner = (Inner *)node;
+        size_t c = 0;
+        while (c + 1 < node->size && index >= inner->bits[c])
+        {
+            rank += inner->ones[c];
+            index -= inner->bits[c++];
+        }
+        node = inner->children[c];
+    }
+
+    uint64_t const *words = ((Leaf *)node)->words;
+    for (size_t w = 0; w < index / WORD_BITS; ++w)
+    {
+        rank += __builtin_popcountll(words[w]);
+    }
+    if (index % WORD_BITS)
+    {
+        rank += __builtin_popcountll(words[index / WORD_BITS] << (WORD_BITS - index % WORD_BITS));
+    }
+    return rank;
+}
+
+size_t dynamic_rank_zero(DynamicBitVector const *dbv, size_t index)
+{
+    index = index < dbv->length ? index : dbv->length;
+    return index - dynamic_rank_one(dbv, index);
+}
+
+size_t dynamic_select_one(DynamicBitVector const *dbv, size_t index)
+{
+    return select_target(dbv, index, true);
+}
+
+size_t dynamic_select_zero(DynamicBitVector const *dbv, size_t index)
+{
+    return select_target(dbv, index, false);
+}
+
+/********** Definitions for Private Functions **********/
+
+static Node *construct_leaf(void)
+{
+    Leaf *leaf = calloc(1, sizeof(Leaf));
+    leaf->node.leaf = true;
+    return &leaf->node;
+}
+
+static Node *construct_inner(void)
+{
+    Inner *inner = calloc(1, sizeof(Inner));
+    inner->node.leaf = false;
+    return &inner->node;
+}
+
+static void destruct_node(Node *node)
+{
+    if (!node->leaf)
+    {
+        Inner *inner = (Inner *)node;
+        for (size_t c = 0; c < node->size; ++c)
+        {
+            destruct_node(inner->children[c]);
+        }
+    }
+    free(node);
+}
+
+static void count_node(Node *node, size_t *bits, size_t *ones)
+{
+    *bits = 0;
+    *ones = 0;
+    if (node->leaf)
+    {
+        Leaf *leaf = (Leaf *)node;
+        *bits = node->size;
+        for (size_t w = 0; w <= LEAF_WORDS; ++w)
+        {
+            *ones += __builtin_popcountll(leaf->words[w]);
+        }
+        return;
+    }
+    Inner *inner = (Inner *)node;
+    for (size_t c = 0; c < node->size; ++c)
+    {
+        *bits += inner->bits[c];
+        *ones += inner->ones[c];
+    }
+}
+
+static size_t select_target(DynamicBitVector const *dbv, size_t index, bool target)
+{
+    size_t bit_num;
+    size_t one_num;
+    count_node(dbv->root, &bit_num, &one_num);
+    check_index(dbv, index, target ? one_num : bit_num - one_num);
+
+    // Skip children with at most `index` target bits, then scan words of the leaf.
+    size_t position = 0;
+    Node *node = dbv->root;
+    while (!node->leaf)
+    {
+        Inner *inner = (Inner *)node;
+        size_t c = 0;
+        size_t target_num = target ? inner->ones[0] : inner->bits[0] - inner->ones[0];
+        while (index >= target_num)
+        {
+            index -= target_num;
+            position += inner->bits[c++];
+            target_num = target ? inner->ones[c] : inner->bits[c] - inner->ones[c];
+        }
+        node = inner->children[c];
+    }
+
+    uint64_t const *words = ((Leaf *)node)->words;
+    size_t word = 0;
+    uint64_t bits = target ? words[0] : ~words[0];
+    size_t target_num = __builtin_popcountll(bits);
+    while (index >= target_num)
+    {
+        index -= target_num;
+        ++word;
+        bits = target ? words[word] : ~words[word];
+        target_num = __builtin_popcountll(bits);
+    }
+    return position + word * WORD_BITS + select_in_word(bits, index);
+}
+
+static void update_bit(DynamicBitVector *dbv, size_t index, Update update)
+{
+    // Record the one counts on the path, then adjust them by the change of the bit.
+    check_index(dbv, index, dbv->length);
+    size_t *path[MAX_DEPTH];
+    size_t depth = 0;
+    Node *node = dbv->root;
+    while (!node->leaf)
+    {
+        Inner *inner = (Inner *)node;
+        size_t c = 0;
+        while (index >= inner->bits[c])
+        {
+            index -= inner->bits[c++];
+        }
+        path[depth++] = &inner->ones[c];
+        node = inner->children[c];
+    }
+
+    uint64_t *word = &((Leaf *)node)->words[index / WORD_BITS];
+    uint64_t mask = (uint64_t)1 << (index % WORD_BITS);
+    bool old_bit = *word & mask;
+    bool new_bit = update == UPDATE_SET || (update == UPDATE_FLIP && !old_bit);
+    if (old_bit == new_bit)
+    {
+        return;
+    }
+    *word ^= mask;
+    for (size_t i = 0; i < depth; ++i)
+    {
+        *path[i] = new_bit ? *path[i] + 1 : *path[i] - 1;
+    }
+}
+
+static Node *insert_node(Node *node, size_t index, bool bit)
+{
+    // Insert into the subtree, returning the new right half of the node if it splits.
+    if (node->leaf)
+    {
+        leaf_insert((Leaf *)node, index, bit);
+        return node->size > LEAF_BITS ? split_node(node) : NULL;
+    }
+
+    // Positions between two children go to the end of the left one.
+    Inner *inner = (Inner *)node;
+    size_t c = 0;
+    while (c + 1 < node->size && index > inner->bits[c])
+    {
+        index -= inner->bits[c++];
+    }
+    Node *sibling = insert_node(inner->children[c], index, bit);
+    inner->bits[c] += 1;
+    inner->ones[c] += bit;
+    if (sibling)
+    {
+        size_t moved = node->size - c - 1;
+        memmove(&inner->bits[c + 2], &inner->bits[c + 1], moved * sizeof(size_t));
+        memmove(&inner->ones[c + 2], &inner->ones[c + 1], moved * sizeof(size_t));
+        memmove(&inner->children[c + 2], &inner->children[c + 1], moved * sizeof(Node *));
+        inner->children[c + 1] = sibling;
+        ++node->size;
+        count_node(inner->children[c], &inner->bits[c], &inner->ones[c]);
+        count_node(sibling, &inner->bits[c + 1], &inner->ones[c + 1]);
+    }
+    return node->size > FANOUT ? split_node(node) : NULL;
+}
+
+static bool delete_node(Node *node, size_t index)
+{
+    // Delete from the subtree, rebalancing children that become underfull.
+    if (node->leaf)
+    {
+        return leaf_delete((Leaf *)node, index);
+    }
+
+    Inner *inner = (Inner *)node;
+    size_t c = 0;
+    while (index >= inner->bits[c])
+    {
+        index -= inner->bits[c++];
+    }
+    bool bit = delete_node(inner->children[c], index);
+    inner->bits[c] -= 1;
+    inner->ones[c] -= bit;
+    if (is_underfull(inner->children[c]))
+    {
+        rebalance(inner, c);
+    }
+    return bit;
+}
+
+static Node *split_node(Node *node)
+{
+    // Move the right half of the node to a new sibling.
+    size_t half = node->size / 2;
+    if (node->leaf)
+    {
+        Leaf *left = (Leaf *)node;
+        Leaf *right = (Leaf *)construct_leaf();
+        append_bits(right->words, 0, left->words, half, node->size - half);
+        right->node.size = node->size - half;
+        clear_tail(left->words, half, LEAF_WORDS + 1);
+        node->size = half;
+        return &right->node;
+    }
+
+    Inner *left = (Inner *)node;
+    Inner *right = (Inner *)construct_inner();
+    size_t moved = node->size - half;
+    memcpy(right->bits, &left->bits[half], moved * sizeof(size_t));
+    memcpy(right->ones, &left->ones[half], moved * sizeof(size_t));
+    memcpy(right->children, &left->children[half], moved * sizeof(Node *));
+    right->node.size = moved;
+    node->size = half;
+    return &right->node;
+}
+
+static void rebalance(Inner *inner, size_t child)
+{
+    // Merge the child with a sibling if both fit in one node, or share their contents evenly
+    // between them otherwise.
+    if (inner->node.size < 2)
+    {
+        return;
+    }
+    size_t l = child ? child - 1 : child;
+    Node *left = inner->children[l];
+    Node *right = inner->children[l + 1];
+    size_t total = left->size + right->size;
+    bool merged = left->leaf ? total <= LEAF_BITS : total <= FANOUT;
+    if (left->leaf)
+    {
+        Leaf *left_leaf = (Leaf *)left;
+        Leaf *right_leaf = (Leaf *)right;
+        if (merged)
+        {
+            append_bits(left_leaf->words, left->size, right_leaf->words, 0, right->size);
+            left->size = total;
+            remove_child(inner, l + 1);
+        }
+        else
+        {
+            uint64_t words[2 * (LEAF_WORDS + 1)] = {0};
+            append_bits(words, 0, left_leaf->words, 0, left->size);
+            append_bits(words, left->size, right_leaf->words, 0, right->size);
+            memset(left_leaf->words, 0, sizeof(left_leaf->words));
+            memset(right_leaf->words, 0, sizeof(right_leaf->words));
+            append_bits(left_leaf->words, 0, words, 0, total / 2);
+            append_bits(right_leaf->words, 0, words, total / 2, total - total / 2);
+            left->size = total / 2;
+            right->size = total - total / 2;
+        }
+    }
+    else
+    {
+        Inner *left_inner = (Inner *)left;
+        Inner *right_inner = (Inner *)right;
+        Node *children[2 * (FANOUT + 1)];
+        memcpy(children, left_inner->children, left->size * sizeof(Node *));
+        memcpy(&children[left->size], right_inner->children, right->size * sizeof(Node *));
+        size_t left_num = merged ? total : total / 2;
+        left->size = left_num;
+        right->size = total - left_num;
+        for (size_t c = 0; c < total; ++c)
+        {
+            Inner *target = c < left_num ? left_inner : right_inner;
+            size_t slot = c < left_num ? c : c - left_num;
+            target->children[slot] = children[c];
+            count_node(children[c], &target->bits[slot], &target->ones[slot]);
+        }
+        if (merged)
+        {
+            remove_child(inner, l + 1);
+        }
+    }
+
+    count_node(left, &inner->bits[l], &inner->ones[l]);
+    if (!merged)
+    {
+        count_node(right, &inner->bits[l + 1], &inner->ones[l + 1]);
+    }
+}
+
+static void remove_child(Inner *inner, size_t child)
+{
+    // Free the emptied child and close the gap.
+    free(inner->children[child]);
+    size_t moved = inner->node.size - child - 1;
+    memmove(&inner->bits[child], &inner->bits[child + 1], moved * sizeof(size_t));
+    memmove(&inner->ones[child], &inner->ones[child + 1], moved * sizeof(size_t));
+    memmove(&inner->children[child], &inner->children[child + 1], moved * sizeof(Node *));
+    --inner->node.size;
+}
+
+static bool is_underfull(Node *node)
+{
+    return node->leaf ? node->size < MIN_LEAF_BITS : node->size < MIN_FANOUT;
+}
+
+static void leaf_insert(Leaf *leaf, size_t index, bool bit)
+{
+    // Shift bits from `index` on by one, starting from the last word.
+    size_t word = index / WORD_BITS;
+    size_t offset = index % WORD_BITS;
+    for (size_t w = leaf->node.size / WORD_BITS; w > word; --w)
+    {
+        leaf->words[w] = leaf->words[w] << 1 | leaf->words[w - 1] >> (WORD_BITS - 1);
+    }
+    uint64_t low_mask = ((uint64_t)1 << offset) - 1;
+    uint64_t value = leaf->words[word];
+    leaf->words[word] = (value & low_mask) | (value & ~low_mask) << 1 | (uint64_t)bit << offset;
+    ++leaf->node.size;
+}
+
+static bool leaf_delete(Leaf *leaf, size_t index)
+{
+    // Shift bits after `index` back by one, starting from the word of `index`.
+    size_t word = index / WORD_BITS;
+    size_t offset = index % WORD_BITS;
+    uint64_t low_mask = ((uint64_t)1 << offset) - 1;
+    uint64_t value = leaf->words[word];
+    bool bit = value >> offset & 1;
+    leaf->words[word] = (value & low_mask) | (value >> 1 & ~low_mask);
+    for (size_t w = word; w < (leaf->node.size - 1) / WORD_BITS; ++w)
+    {
+        leaf->words[w] |= leaf->words[w + 1] << (WORD_BITS - 1);
+        leaf->words[w + 1] >>= 1;
+    }
+    --leaf->node.size;
+    return bit;
+}
+
+static void append_bits(uint64_t *words, size_t length, uint64_t const *source, size_t start, size_t count)
+{
+    // Copy `count` bits of `source` from `start` after the first `length` bits of `words`,
+    // whose following bits must be 0.
+    for (size_t i = 0; i < count; i += WORD_BITS)
+    {
+        size_t width = count - i < WORD_BITS ? count - i : WORD_BITS;
+        size_t from = start + i;
+        uint64_t value = read_bits(source, start + count, from, width);
+
+        size_t to = length + i;
+        words[to / WORD_BITS] |= value << (to % WORD_BITS);
+        if (to % WORD_BITS && to % WORD_BITS + width > WORD_BITS)
+        {
+            words[to / WORD_BITS + 1] |= value >> (WORD_BITS - to % WORD_BITS);
+        }
+    }
+}
+
+static void clear_tail(uint64_t *words, size_t length, size_t word_number)
+{
+    size_t word = length / WORD_BITS;
+    if (length % WORD_BITS)
+    {
+        words[word++] &= ((uint64_t)1 << (length % WORD_BITS)) - 1;
+    }
+    memset(&words[word], 0, (word_number - word) * sizeof(uint64_t));
+}
+
+static void check_index(DynamicBitVector const *dbv, size_t index, size_t limit)
+{
+    if (index >= limit)
+    {
+        fprintf(stderr, "Error: Index %zu is out of range for a dynamic bit vector of %zu bits.\n", index,
+                dbv->length);
+        exit(EXIT_FAILURE);
+    }
+}
@@ -0,0 +1,304 @@
+#include "elias_fano.h"
+#include "word.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define WORD_BITS 64
+
+// Every this many ones and zeros of the high bits have their positions sampled, so selecting
+// on the high bits scans only a few words.
+#define HIGH_SAMPLE_RATE 256
+
+// Buckets are walked for this many ones before being binary searched, which pays off for
+// buckets of dense stretches holding many ones.
+#define BUCKET_SCAN 8
+
+/********** Declarations of Private Functions **********/
+
+static EliasFanoVector *init_elias_fano_vector(size_t one_number, size_t length);
+static void push_one(EliasFanoVector *ef, size_t index, size_t position);
+static void sample_highs(EliasFanoVector *ef);
+static size_t select_high(EliasFanoVector const *ef, size_t index, bool target);
+static size_t ones_before_bucket(EliasFanoVector const *ef, size_t bucket);
+static size_t count_in_bucket(EliasFanoVector const *ef, size_t bucket, size_t index, bool target);
+static bool precedes(EliasFanoVector const *ef, size_t bucket, size_t one, size_t index, bool target);
+static uint64_t get_high_word(EliasFanoVector const *ef, size_t word, bool target);
+
+/********** Definitions of `EliasFanoVector` and Public Functions **********/
+
+struct EliasFanoVector
+{
+    size_t length;
+    size_t one_number;
+
+    // The low `low_width` bits of every position, packed in order.
+    size_t low_width;
+    uint64_t *lows;
+
+    // One `i` sets bit `(position >> low_width) + i` of the high bits, so the ones of every
+    // bucket of positions sharing their high bits are followed by a zero.
+    size_t high_length;
+    uint64_t *highs;
+
+    // Positions in the high bits of every `HIGH_SAMPLE_RATE`-th one and zero.
+    size_t one_sample_number;
+    size_t *one_samples;
+    size_t zero_sample_number;
+    size_t *zero_samples;
+};
+
+EliasFanoVector *construct_elias_fano_vector(size_t const *positions, size_t one_number, size_t length)
+{
+    EliasFanoVector *ef = init_elias_fano_vector(one_number, length);
+    for (size_t i = 0; i < one_number; ++i)
+    {
+        push_one(ef, i, positions[i]);
+    }
+    sample_highs(ef);
+    return ef;
+}
+
+EliasFanoVector *construct_elias_fano_vector_from_words(uint64_t const *words, size_t length)
+{
+    // Count ones first to choose the width of the low bits.
+    size_t word_num = word_number(length);
+    size_t one_num = 0;
+    for (size_t w = 0; w < word_num; ++w)
+    {
+        one_num += __builtin_popcountll(read_word(words, length, w));
+    }
+
+    EliasFanoVector *ef = init_elias_fano_vector(one_num, length);
+    size_t index = 0;
+    for (size_t w = 0; w < word_num; ++w)
+    {
+        uint64_t word = read_word(words, length, w);
+        while (word)
+        {
+            push_one(ef, index++, w * WORD_BITS + __builtin_ctzll(word));
+            word &= word - 1;
+        }
+    }
+    sample_highs(ef);
+    return ef;
+}
+
+void destruct_elias_fano_vector(EliasFanoVector *ef)
+{
+    free(ef->lows);
+    free(ef->highs);
+    free(ef->one_samples);
+    free(ef->zero_samples);
+    free(ef);
+}
+
+size_t elias_fano_rank_one(EliasFanoVector const *ef, size_t index)
+{
+    if (index >= ef->length)
+    {
+        return ef->one_number;
+    }
+
+    return count_in_bucket(ef, index >> ef->low_width, index, true);
+}
+
+size_t elias_fano_select(EliasFanoVector const *ef, size_t index, bool target)
+{
+    if (target)
+    {
+        // The high bits of the position are the number of zeros before the one.
+        size_t high = select_high(ef, index, true) - index;
+        return high << ef->low_width | read_field(ef->lows, index * ef->low_width, ef->low_width);
+    }
+
+    // Bucket `b` starts with `(b << low_width) - ones_before_bucket(b)` zeros before it, and
+    // at most all ones come before the target zero, which bounds the buckets to search.
+    size_t low = index >> ef->low_width;
+    size_t high = (index + ef->one_number) >> ef->low_width;
+    size_t bucket_num = (ef->length >> ef->low_width) + 1;
+    high = high < bucket_num - 1 ? high : bucket_num - 1;
+    while (low < high)
+    {
+        size_t middle = low + (high - low + 1) / 2;
+        if ((middle << ef->low_width) - ones_before_bucket(ef, middle) <= index)
+        {
+            low = middle;
+        }
+        else
+        {
+            high = middle - 1;
+        }
+    }
+
+    return index + count_in_bucket(ef, low, index, false);
+}
+
+size_t elias_fano_rank_directory_size(EliasFanoVector const *ef)
+{
+    return ef->zero_sample_number * sizeof(size_t);
+}
+
+void elias_fano_space_usage(EliasFanoVector const *ef, size_t *bytes)
+{
+    // Zero samples serve both rank and select_0 queries.
+    size_t low_words = word_number(ef->one_number * ef->low_width) + 1;
+    size_t high_words = word_number(ef->high_length) + 1;
+    bytes[SPACE_PAYLOAD] += (low_words + high_words) * sizeof(uint64_t);
+    bytes[SPACE_RANK_BLOCKS] += elias_fano_rank_directory_size(ef);
+    bytes[SPACE_SELECT_ONE] += ef->one_sample_number * sizeof(size_t);
+    bytes[SPACE_ALLOCATOR_OVERHEAD] += sizeof(EliasFanoVector);
+}
+
+/********** Definitions for Private Functions **********/
+
+static EliasFanoVector *init_elias_fano_vector(size_t one_number, size_t length)
+{
+    // Use floor(log2(n / m)) low bits, which minimizes the total space, counting at least one
+    // one so that the high bits of empty bit strings stay short too.
+    EliasFanoVector *ef = malloc(sizeof(EliasFanoVector));
+    ef->length = length;
+    ef->one_number = one_number;
+    size_t gap = length / (one_number ? one_number : 1);
+    ef->low_width = gap > 1 ? WORD_BITS - 1 - __builtin_clzll(gap) : 0;
+    ef->lows = calloc(word_number(one_number * ef->low_width) + 1, sizeof(uint64_t));
+    ef->high_length = one_number + (length >> ef->low_width) + 1;
+    ef->highs = calloc(word_number(ef->high_length) + 1, sizeof(uint64_t));
+    return ef;
+}
+
+static void push_one(EliasFanoVector *ef, size_t index, size_t position)
+{
+    write_field(ef->lows, index * ef->low_width, ef->low_width, position & (((uint64_t)1 << ef->low_width) - 1));
+    size_t high = (position >> ef->low_width) + index;
+    ef->highs[high / WORD_BITS] |= (uint64_t)1 << (high % WORD_BITS);
+}
+
+static void sample_highs(EliasFanoVector *ef)
+{
+    size_t counts[2] = {ef->high_length - ef->one_number, ef->one_number};
+    size_t *samples[2];
+    for (size_t target = 0; target < 2; ++target)
+    {
+        size_t sample_num = (counts[target] + HIGH_SAMPLE_RATE - 1) / HIGH_SAMPLE_RATE;
+        samples[target] = malloc((sample_num ? sample_num : 1) * sizeof(size_t));
+        counts[target] = 0;
+        if (target)
+        {
+            ef->one_sample_number = sample_num;
+        }
+        else
+        {
+            ef->zero_sample_number = sample_num;
+        }
+    }
+    ef->zero_samples = samples[0];
+    ef->one_samples = samples[1];
+
+    // Record the position of every sampled one and zero in a single scan.
+    size_t word_num = word_number(ef->high_length);
+    for (size_t w = 0; w < word_num; ++w)
+    {
+        for (size_t target = 0; target < 2; ++target)
+        {
+            uint64_t word = get_high_word(ef, w, target);
+            size_t target_num = __builtin_popcountll(word);
+            size_t next = (counts[target] + HIGH_SAMPLE_RATE - 1) / HIGH_SAMPLE_RATE * HIGH_SAMPLE_RATE;
+            while (counts[target] + target_num > next)
+            {
+                samples[target][next / HIGH_SAMPLE_RATE] = w * WORD_BITS + select_in_word(word, next - counts[target]);
+                next += HIGH_SAMPLE_RATE;
+            }
+            counts[target] += target_num;
+        }
+    }
+}
+
+static size_t select_high(EliasFanoVector const *ef, size_t index, bool target)
+{
+    // Start from the nearest sample and scan words, which are about half ones.
+    size_t *samples = target ? ef->one_samples : ef->zero_samples;
+    size_t position = samples[index / HIGH_SAMPLE_RATE];
+    size_t remaining = index % HIGH_SAMPLE_RATE;
+    size_t word = position / WORD_BITS;
+    uint64_t bits = get_high_word(ef, word, target) & (~(uint64_t)0 << (position % WORD_BITS));
+    size_t target_num = __builtin_popcountll(bits);
+    while (remaining >= target_num)
+    {
+        remaining -= target_num;
+        bits = get_high_word(ef, ++word, target);
+        target_num = __builtin_popcountll(bits);
+    }
+    return word * WORD_BITS + select_in_word(bits, remaining);
+}
+
+static size_t ones_before_bucket(EliasFanoVector const *ef, size_t bucket)
+{
+    // The zero ending the previous bucket follows all ones before this one.
+    if (!bucket)
+    {
+        return 0;
+    }
+    else if (bucket > ef->length >> ef->low_width)
+    {
+        return ef->one_number;
+    }
+    return select_high(ef, bucket - 1, false) - (bucket - 1);
+}
+
+static size_t count_in_bucket(EliasFanoVector const *ef, size_t bucket, size_t index, bool target)
+{
+    // Count ones before the bucket and those in it preceding position `index`, or zero
+    // `index` if `target` is false. Walk the first few ones of the bucket in the high bits,
+    // then binary search the rest up to the end of the bucket.
+    size_t rank = ones_before_bucket(ef, bucket);
+    size_t position = rank + bucket;
+    for (size_t i = 0; i < BUCKET_SCAN; ++i)
+    {
+        if (!(ef->highs[position / WORD_BITS] >> (position % WORD_BITS) & 1) ||
+            !precedes(ef, bucket, rank, index, target))
+        {
+            return rank;
+        }
+        ++rank;
+        ++position;
+    }
+
+    size_t low = rank;
+    size_t high = ones_before_bucket(ef, bucket + 1);
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        if (precedes(ef, bucket, middle, index, target))
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+static bool precedes(EliasFanoVector const *ef, size_t bucket, size_t one, size_t index, bool target)
+{
+    // Ones come before zero `index` when at most `index` zeros come before them.
+    size_t position = bucket << ef->low_width | read_field(ef->lows, one * ef->low_width, ef->low_width);
+    return target ? position < index : position - one <= index;
+}
+
+static uint64_t get_high_word(EliasFanoVector const *ef, size_t word, bool target)
+{
+    // Zeros are read from the complemented word, without bits past the end.
+    uint64_t value = ef->highs[word];
+    if (target)
+    {
+        return value;
+    }
+    value = ~value;
+    size_t tail = ef->high_length - word * WORD_BITS;
+    return tail < WORD_BITS ? value & (((uint64_t)1 << tail) - 1) : value;
+}
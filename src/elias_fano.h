@@ -0,0 +1,31 @@
+#ifndef ELIAS_FANO_H
+#define ELIAS_FANO_H 1
+
+#include "../include/bit_vector.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// An Elias-Fano encoded bit string, which splits the position of every one into low bits
+// stored verbatim and high bits stored in unary, taking about 2 + log2(n / m) bits per one
+// for `m` ones among `n` bits.
+typedef struct EliasFanoVector EliasFanoVector;
+
+// Encode `length` bits whose ones are at `positions`, which must be strictly increasing and
+// less than `length`. Callers validate positions from outside.
+EliasFanoVector *construct_elias_fano_vector(size_t const *positions, size_t one_number, size_t length);
+// Encode `length` bits packed in `words`.
+EliasFanoVector *construct_elias_fano_vector_from_words(uint64_t const *words, size_t length);
+void destruct_elias_fano_vector(EliasFanoVector *ef);
+
+size_t elias_fano_rank_one(EliasFanoVector const *ef, size_t index);
+size_t elias_fano_select(EliasFanoVector const *ef, size_t index, bool target);
+
+// The number of bytes used by the samples that rank queries use.
+size_t elias_fano_rank_directory_size(EliasFanoVector const *ef);
+
+// Add the bytes used by every component to `bytes`, indexed by `SpaceComponent`.
+void elias_fano_space_usage(EliasFanoVector const *ef, size_t *bytes);
+
+#endif
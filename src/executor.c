@@ -0,0 +1,335 @@
+#include "../include/bit_vector.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+// Batches are split into chunks of this many queries, whose indexes, results and the
+// directory lines they touch stay in the cache of the thread running them.
+#define CHUNK_QUERIES 512
+
+// Chunk indexes of a range are packed into 32 bits each.
+#define MAX_CHUNK_NUMBER ((size_t)UINT32_MAX)
+
+typedef void (*BatchQuery)(BitVector const *bv, size_t const *indexes, size_t n, size_t *results);
+
+// The batch function answering every `QueryType`, indexed by the type.
+static BatchQuery const batch_queries[] = {rank_one_batch, rank_zero_batch, select_one_batch, select_zero_batch};
+#define QUERY_TYPE_NUMBER (sizeof(batch_queries) / sizeof(BatchQuery))
+
+/********** Declarations of Private Functions **********/
+
+typedef struct ChunkRange ChunkRange;
+typedef struct Worker Worker;
+
+static void *run_worker(void *worker);
+static void run_batch(Worker *self);
+static bool pop_chunk(ChunkRange *range, size_t *chunk);
+static bool steal_chunks(ChunkRange *victim, ChunkRange *range, size_t *chunk);
+static void run_chunk(Worker *self, size_t chunk);
+
+/********** Definitions of `QueryExecutor` and Public Functions **********/
+
+// The chunks from `begin` to `end - 1` left to a thread, packed as `begin << 32 | end`. The
+// owner takes chunks from the front and thieves take the back half, both with a single
+// compare-and-swap, and every range sits in a cache line of its own.
+struct ChunkRange
+{
+    _Alignas(64) _Atomic uint64_t chunks;
+};
+
+struct Worker
+{
+    QueryExecutor *executor;
+    size_t thread;
+
+    // Indexes and results of the queries in a chunk sorted by type, and the position of every
+    // sorted query in the batch.
+    size_t indexes[CHUNK_QUERIES];
+    size_t results[CHUNK_QUERIES];
+    size_t positions[CHUNK_QUERIES];
+};
+
+struct QueryExecutor
+{
+    size_t thread_number;
+    pthread_t *threads;
+    Worker *workers;
+    ChunkRange *ranges;
+
+    // The batch being run, which the calling thread joins as thread 0.
+    BitVector const *bv;
+    Query const *queries;
+    size_t query_number;
+    size_t *results;
+
+    // Workers wait for a new generation of batch, and the calling thread waits for all of
+    // them to finish it. Batches from several threads run one after another.
+    pthread_mutex_t batch_mutex;
+    pthread_mutex_t mutex;
+    pthread_cond_t started;
+    pthread_cond_t finished;
+    size_t generation;
+    size_t finished_number;
+    bool stopping;
+};
+
+QueryExecutor *construct_query_executor(size_t thread_number)
+{
+    QueryExecutor *executor = malloc(sizeof(QueryExecutor));
+    if (!executor)
+    {
+        fprintf(stderr, "Error: Cannot allocate a query executor.\n");
+        exit(EXIT_FAILURE);
+    }
+    executor->thread_number = thread_number > 1 ? thread_number : 1;
+    executor->threads = malloc(executor->thread_number * sizeof(pthread_t));
+    executor->workers = malloc(executor->thread_number * sizeof(Worker));
+    executor->ranges = aligned_alloc(64, executor->thread_number * sizeof(ChunkRange));
+    if (!executor->threads || !executor->workers || !executor->ranges)
+    {
+        fprintf(stderr, "Error: Cannot allocate a query executor of %zu threads.\n", executor->thread_number);
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_init(&executor->batch_mutex, NULL);
+    pthread_mutex_init(&executor->mutex, NULL);
+    pthread_cond_init(&executor->started, NULL);
+    pthread_cond_init(&executor->finished, NULL);
+    executor->generation = 0;
+    executor->finished_number = 0;
+    executor->stopping = false;
+    for (size_t thread = 0; thread < executor->thread_number; ++thread)
+    {
+        executor->workers[thread].executor = executor;
+        executor->workers[thread].thread = thread;
+        atomic_init(&executor->ranges[thread].chunks, 0);
+    }
+    // Run with fewer threads if some cannot be created, since batches wait for every worker
+    // counted in `thread_number`. Workers read it only once a batch starts.
+    size_t started = 1;
+    while (started < executor->thread_number &&
+           !pthread_create(&executor->threads[started], NULL, run_worker, &executor->workers[started]))
+    {
+        ++started;
+    }
+    executor->thread_number = started;
+    return executor;
+}
+
+void destruct_query_executor(QueryExecutor *executor)
+{
+    pthread_mutex_lock(&executor->mutex);
+    executor->stopping = true;
+    pthread_cond_broadcast(&executor->started);
+    pthread_mutex_unlock(&executor->mutex);
+    for (size_t thread = 1; thread < executor->thread_number; ++thread)
+    {
+        pthread_join(executor->threads[thread], NULL);
+    }
+
+    pthread_mutex_destroy(&executor->batch_mutex);
+    pthread_mutex_destroy(&executor->mutex);
+    pthread_cond_destroy(&executor->started);
+    pthread_cond_destroy(&executor->finished);
+    free(executor->threads);
+    free(executor->workers);
+    free(executor->ranges);
+    free(executor);
+}
+
+void execute_queries(QueryExecutor *executor, BitVector const *bv, Query const *queries, size_t n, size_t *results)
+{
+    size_t chunk_num = (n + CHUNK_QUERIES - 1) / CHUNK_QUERIES;
+    if (chunk_num > MAX_CHUNK_NUMBER)
+    {
+        fprintf(stderr, "Error: A batch of %zu queries is too large.\n", n);
+        exit(EXIT_FAILURE);
+    }
+    for (size_t q = 0; q < n; ++q)
+    {
+        if ((size_t)queries[q].type >= QUERY_TYPE_NUMBER)
+        {
+            fprintf(stderr, "Error: Query %zu has an unknown type %d.\n", q, (int)queries[q].type);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Give every thread an even share of consecutive chunks to start with, waking the
+    // workers only for batches of more than one chunk.
+    pthread_mutex_lock(&executor->batch_mutex);
+    size_t thread_num = executor->thread_number;
+    bool parallel = thread_num > 1 && chunk_num > 1;
+    for (size_t thread = 0; thread < thread_num; ++thread)
+    {
+        uint64_t begin = parallel ? chunk_num * thread / thread_num : 0;
+        uint64_t end = parallel ? chunk_num * (thread + 1) / thread_num : thread ? 0 : chunk_num;
+        atomic_store_explicit(&executor->ranges[thread].chunks, begin << 32 | end, memory_order_relaxed);
+    }
+    executor->bv = bv;
+    executor->queries = queries;
+    executor->query_number = n;
+    executor->results = results;
+    if (parallel)
+    {
+        pthread_mutex_lock(&executor->mutex);
+        executor->finished_number = 0;
+        ++executor->generation;
+        pthread_cond_broadcast(&executor->started);
+        pthread_mutex_unlock(&executor->mutex);
+    }
+    run_batch(&executor->workers[0]);
+    if (parallel)
+    {
+        pthread_mutex_lock(&executor->mutex);
+        while (executor->finished_number < thread_num - 1)
+        {
+            pthread_cond_wait(&executor->finished, &executor->mutex);
+        }
+        pthread_mutex_unlock(&executor->mutex);
+    }
+    pthread_mutex_unlock(&executor->batch_mutex);
+}
+
+/********** Definitions for Private Functions **********/
+
+static void *run_worker(void *worker)
+{
+    Worker *self = worker;
+    QueryExecutor *executor = self->executor;
+    size_t generation = 0;
+    while (true)
+    {
+        pthread_mutex_lock(&executor->mutex);
+        while (executor->generation == generation && !executor->stopping)
+        {
+            pthread_cond_wait(&executor->started, &executor->mutex);
+        }
+        generation = executor->generation;
+        bool stopping = executor->stopping;
+        pthread_mutex_unlock(&executor->mutex);
+        if (stopping)
+        {
+            return NULL;
+        }
+
+        run_batch(self);
+
+        pthread_mutex_lock(&executor->mutex);
+        if (++executor->finished_number == executor->thread_number - 1)
+        {
+            pthread_cond_signal(&executor->finished);
+        }
+        pthread_mutex_unlock(&executor->mutex);
+    }
+}
+
+static void run_batch(Worker *self)
+{
+    // Run our own chunks, then steal from the other threads in turn until all are empty.
+    QueryExecutor *executor = self->executor;
+    ChunkRange *range = &executor->ranges[self->thread];
+    size_t chunk;
+    while (true)
+    {
+        while (pop_chunk(range, &chunk))
+        {
+            run_chunk(self, chunk);
+        }
+        bool stolen = false;
+        for (size_t i = 1; i < executor->thread_number && !stolen; ++i)
+        {
+            ChunkRange *victim = &executor->ranges[(self->thread + i) % executor->thread_number];
+            stolen = steal_chunks(victim, range, &chunk);
+        }
+        if (!stolen)
+        {
+            return;
+        }
+        run_chunk(self, chunk);
+    }
+}
+
+static bool pop_chunk(ChunkRange *range, size_t *chunk)
+{
+    uint64_t chunks = atomic_load_explicit(&range->chunks, memory_order_relaxed);
+    while ((chunks >> 32) < (chunks & UINT32_MAX))
+    {
+        if (atomic_compare_exchange_weak_explicit(&range->chunks, &chunks, chunks + ((uint64_t)1 << 32),
+                                                  memory_order_relaxed, memory_order_relaxed))
+        {
+            *chunk = chunks >> 32;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool steal_chunks(ChunkRange *victim, ChunkRange *range, size_t *chunk)
+{
+    // Take the back half of the victim's chunks, run the first of them and keep the rest as
+    // our own range, which is empty until then so no other thread changes it.
+    uint64_t chunks = atomic_load_explicit(&victim->chunks, memory_order_relaxed);
+    while (true)
+    {
+        uint64_t begin = chunks >> 32;
+        uint64_t end = chunks & UINT32_MAX;
+        if (begin >= end)
+        {
+            return false;
+        }
+        uint64_t middle = begin + (end - begin) / 2;
+        if (atomic_compare_exchange_weak_explicit(&victim->chunks, &chunks, begin << 32 | middle,
+                                                  memory_order_relaxed, memory_order_relaxed))
+        {
+            *chunk = middle;
+            atomic_store_explicit(&range->chunks, (middle + 1) << 32 | end, memory_order_relaxed);
+            return true;
+        }
+    }
+}
+
+static void run_chunk(Worker *self, size_t chunk)
+{
+    // Sort the queries by type with a counting sort, answer the queries of every type
+    // together with the batch queries, then put the results back in the order of the queries.
+    QueryExecutor *executor = self->executor;
+    size_t first = chunk * CHUNK_QUERIES;
+    size_t last = first + CHUNK_QUERIES < executor->query_number ? first + CHUNK_QUERIES : executor->query_number;
+    Query const *queries = executor->queries;
+    size_t offsets[QUERY_TYPE_NUMBER + 1] = {0};
+    for (size_t q = first; q < last; ++q)
+    {
+        ++offsets[queries[q].type + 1];
+    }
+    for (size_t type = 0; type < QUERY_TYPE_NUMBER; ++type)
+    {
+        offsets[type + 1] += offsets[type];
+    }
+    size_t next[QUERY_TYPE_NUMBER];
+    for (size_t type = 0; type < QUERY_TYPE_NUMBER; ++type)
+    {
+        next[type] = offsets[type];
+    }
+    for (size_t q = first; q < last; ++q)
+    {
+        size_t i = next[queries[q].type]++;
+        self->indexes[i] = queries[q].index;
+        self->positions[i] = q;
+    }
+    for (size_t type = 0; type < QUERY_TYPE_NUMBER; ++type)
+    {
+        size_t n = offsets[type + 1] - offsets[type];
+        if (n)
+        {
+            batch_queries[type](executor->bv, self->indexes + offsets[type], n, self->results + offsets[type]);
+        }
+    }
+    for (size_t i = 0; i < last - first; ++i)
+    {
+        executor->results[self->positions[i]] = self->results[i];
+    }
+}
@@ -0,0 +1,68 @@
+#include "huge_page.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+// Reserved huge pages come in the default size of the system unless a size is requested, and
+// unmapping fails on mappings of a different size. The flag is missing from older C libraries.
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT) && !defined(MAP_HUGE_2MB)
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+
+/********** Definitions of Public Functions **********/
+
+size_t huge_page_round(size_t size)
+{
+    return (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+}
+
+void *huge_page_alloc(size_t size)
+{
+    if (size < HUGE_PAGE_SIZE)
+    {
+        return NULL;
+    }
+    size = huge_page_round(size);
+
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_2MB)
+    // Reserved huge pages are used as a whole or not at all, and are always aligned.
+    void *reserved = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB,
+                          -1, 0);
+    if (reserved != MAP_FAILED)
+    {
+        return reserved;
+    }
+#endif
+
+    // Map one more huge page than needed and unmap the ends around the aligned part.
+    uint8_t *mapping = mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED)
+    {
+        return NULL;
+    }
+    uint8_t *data = (uint8_t *)huge_page_round((uintptr_t)mapping);
+    size_t head = data - mapping;
+    if (head)
+    {
+        munmap(mapping, head);
+    }
+    munmap(data + size, HUGE_PAGE_SIZE - head);
+    huge_page_advise(data, size);
+    return data;
+}
+
+void huge_page_free(void *data, size_t size)
+{
+    munmap(data, huge_page_round(size));
+}
+
+void huge_page_advise(void *data, size_t size)
+{
+#ifdef MADV_HUGEPAGE
+    madvise(data, size, MADV_HUGEPAGE);
+#else
+    (void)data;
+    (void)size;
+#endif
+}
@@ -0,0 +1,25 @@
+#ifndef HUGE_PAGE_H
+#define HUGE_PAGE_H 1
+
+#include <stddef.h>
+
+// Large arrays are mapped in multiples of this size and aligned to it, so that the kernel can
+// back them with huge pages and random accesses to them miss the TLB less often.
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+// The size of `size` bytes rounded up to whole huge pages.
+size_t huge_page_round(size_t size);
+
+// Map `huge_page_round(size)` zero-filled bytes aligned to a huge page, from reserved 2 MB huge
+// pages of the system if there are any and as transparent huge pages otherwise. Returns NULL
+// for sizes below a huge page, which would waste most of it, or if the mapping fails.
+void *huge_page_alloc(size_t size);
+
+// Unmap memory from `huge_page_alloc` of the same `size`.
+void huge_page_free(void *data, size_t size);
+
+// Ask for transparent huge pages backing `size` bytes at `data`, which must be aligned to a
+// huge page. This is only a hint, which is silently ignored when the kernel refuses it.
+void huge_page_advise(void *data, size_t size);
+
+#endif
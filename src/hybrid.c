@@ -0,0 +1,448 @@
+#include "hybrid.h"
+#include "word.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define WORD_BITS 64
+#define BLOCK_WORDS 1024
+#define BLOCK_BITS (BLOCK_WORDS * WORD_BITS)
+
+// Plain blocks record the number of ones before every subblock of this many words relative to
+// the block, so rank and select scan at most a few words.
+#define SUBBLOCK_WORDS 8
+#define SUBBLOCK_NUMBER (BLOCK_WORDS / SUBBLOCK_WORDS)
+
+// Entries of a run are its first and last positions and the number of ones before it in the
+// block.
+#define RUN_ENTRIES 3
+
+typedef enum BlockType
+{
+    BLOCK_EMPTY,
+    BLOCK_FULL,
+    BLOCK_PLAIN,
+    BLOCK_SPARSE,
+    BLOCK_RUNS,
+} BlockType;
+
+typedef struct HybridBlock
+{
+    // The number of ones before the block.
+    size_t rank;
+    // The index of plain blocks among all plain blocks, or of the first entry of the others.
+    size_t offset;
+    // The number of ones of sparse blocks, or of runs of run blocks.
+    uint32_t count;
+    uint8_t type;
+} HybridBlock;
+
+// The runs of a block being recorded, and the number of ones before the next run.
+typedef struct RunRecord
+{
+    uint16_t *runs;
+    size_t run_number;
+    size_t one_number;
+} RunRecord;
+
+/********** Declarations of Private Functions **********/
+
+static size_t block_rank_one(HybridVector const *hybrid, HybridBlock *block, size_t index);
+static size_t block_select(HybridVector const *hybrid, HybridBlock *block, size_t index, bool target);
+static size_t plain_select(HybridVector const *hybrid, HybridBlock *block, size_t index, bool target);
+static size_t count_positions_below(uint16_t const *positions, size_t n, size_t index);
+static void fill_plain(HybridVector *hybrid, uint64_t const *words, size_t block, size_t plain);
+static void fill_positions(uint64_t const *words, size_t length, size_t block, uint16_t *positions);
+static size_t fill_runs(uint64_t const *words, size_t length, size_t block, uint16_t *runs);
+static void record_run(void *context, size_t start, size_t end);
+static size_t block_word_number(size_t length, size_t block);
+
+/********** Definitions of `HybridVector` and Public Functions **********/
+
+struct HybridVector
+{
+    size_t length;
+    size_t one_number;
+
+    size_t block_number;
+    HybridBlock *blocks;
+
+    // Words and subblock ranks of plain blocks, stored one block after another.
+    size_t plain_number;
+    uint64_t *words;
+    uint16_t *subranks;
+
+    // Positions of sparse blocks and runs of run blocks, relative to their blocks.
+    size_t entry_number;
+    uint16_t *entries;
+};
+
+HybridVector *construct_hybrid_vector(uint64_t const *words, size_t length)
+{
+    HybridVector *hybrid = malloc(sizeof(HybridVector));
+    hybrid->length = length;
+    hybrid->block_number = (length + BLOCK_BITS - 1) / BLOCK_BITS;
+    hybrid->blocks = malloc((hybrid->block_number ? hybrid->block_number : 1) * sizeof(HybridBlock));
+
+    // Measure every block and choose its cheapest encoding, counting plain blocks and entries
+    // along the way.
+    size_t rank = 0;
+    size_t plain_num = 0;
+    size_t entry_num = 0;
+    for (size_t b = 0; b < hybrid->block_number; ++b)
+    {
+        HybridBlock *block = &hybrid->blocks[b];
+        size_t bit_num = length - b * BLOCK_BITS < BLOCK_BITS ? length - b * BLOCK_BITS : BLOCK_BITS;
+        size_t word_num = block_word_number(length, b);
+        size_t one_num = 0;
+        for (size_t w = 0; w < word_num; ++w)
+        {
+            one_num += __builtin_popcountll(read_word(words, length, b * BLOCK_WORDS + w));
+        }
+
+        block->rank = rank;
+        rank += one_num;
+        if (!one_num)
+        {
+            block->type = BLOCK_EMPTY;
+            continue;
+        }
+        if (one_num == bit_num)
+        {
+            block->type = BLOCK_FULL;
+            continue;
+        }
+
+        size_t run_num = fill_runs(words, length, b, NULL);
+        size_t cost = BLOCK_WORDS * sizeof(uint64_t) + SUBBLOCK_NUMBER * sizeof(uint16_t);
+        block->type = BLOCK_PLAIN;
+        if (one_num * sizeof(uint16_t) < cost)
+        {
+            cost = one_num * sizeof(uint16_t);
+            block->type = BLOCK_SPARSE;
+            block->count = one_num;
+        }
+        if (run_num * RUN_ENTRIES * sizeof(uint16_t) < cost)
+        {
+            block->type = BLOCK_RUNS;
+            block->count = run_num;
+        }
+
+        if (block->type == BLOCK_PLAIN)
+        {
+            block->offset = plain_num++;
+        }
+        else
+        {
+            block->offset = entry_num;
+            entry_num += block->type == BLOCK_SPARSE ? one_num : run_num * RUN_ENTRIES;
+        }
+    }
+    hybrid->one_number = rank;
+
+    // Fill the payload of every block.
+    hybrid->plain_number = plain_num;
+    hybrid->words = calloc(plain_num * BLOCK_WORDS + 1, sizeof(uint64_t));
+    hybrid->subranks = malloc((plain_num * SUBBLOCK_NUMBER + 1) * sizeof(uint16_t));
+    hybrid->entry_number = entry_num;
+    hybrid->entries = malloc((entry_num + 1) * sizeof(uint16_t));
+    for (size_t b = 0; b < hybrid->block_number; ++b)
+    {
+        HybridBlock *block = &hybrid->blocks[b];
+        if (block->type == BLOCK_PLAIN)
+        {
+            fill_plain(hybrid, words, b, block->offset);
+        }
+        else if (block->type == BLOCK_SPARSE)
+        {
+            fill_positions(words, length, b, hybrid->entries + block->offset);
+        }
+        else if (block->type == BLOCK_RUNS)
+        {
+            fill_runs(words, length, b, hybrid->entries + block->offset);
+        }
+    }
+
+    return hybrid;
+}
+
+void destruct_hybrid_vector(HybridVector *hybrid)
+{
+    free(hybrid->blocks);
+    free(hybrid->words);
+    free(hybrid->subranks);
+    free(hybrid->entries);
+    free(hybrid);
+}
+
+size_t hybrid_rank_one(HybridVector const *hybrid, size_t index)
+{
+    if (index >= hybrid->length)
+    {
+        return hybrid->one_number;
+    }
+    HybridBlock *block = &hybrid->blocks[index / BLOCK_BITS];
+    return block->rank + block_rank_one(hybrid, block, index % BLOCK_BITS);
+}
+
+size_t hybrid_select(HybridVector const *hybrid, size_t index, bool target)
+{
+    // Binary search the directory for the last block starting with at most `index` target bits.
+    size_t low = 0;
+    size_t high = hybrid->block_number - 1;
+    while (low < high)
+    {
+        size_t middle = low + (high - low + 1) / 2;
+        size_t rank = hybrid->blocks[middle].rank;
+        rank = target ? rank : middle * BLOCK_BITS - rank;
+        if (rank <= index)
+        {
+            low = middle;
+        }
+        else
+        {
+            high = middle - 1;
+        }
+    }
+
+    HybridBlock *block = &hybrid->blocks[low];
+    size_t rank = target ? block->rank : low * BLOCK_BITS - block->rank;
+    return low * BLOCK_BITS + block_select(hybrid, block, index - rank, target);
+}
+
+size_t hybrid_rank_directory_size(HybridVector const *hybrid)
+{
+    return hybrid->block_number * sizeof(HybridBlock) + hybrid->plain_number * SUBBLOCK_NUMBER * sizeof(uint16_t);
+}
+
+void hybrid_space_usage(HybridVector const *hybrid, size_t *bytes)
+{
+    // Positions and runs take the place of the bits of their blocks.
+    bytes[SPACE_PAYLOAD] += hybrid->plain_number * BLOCK_WORDS * sizeof(uint64_t);
+    bytes[SPACE_PAYLOAD] += hybrid->entry_number * sizeof(uint16_t);
+    bytes[SPACE_RANK_BLOCKS] += hybrid->block_number * sizeof(HybridBlock);
+    bytes[SPACE_RANK_SUBBLOCKS] += hybrid->plain_number * SUBBLOCK_NUMBER * sizeof(uint16_t);
+    bytes[SPACE_ALLOCATOR_OVERHEAD] += sizeof(HybridVector);
+}
+
+/********** Definitions for Private Functions **********/
+
+static size_t block_rank_one(HybridVector const *hybrid, HybridBlock *block, size_t index)
+{
+    // Count ones before `index`, relative to the block.
+    if (block->type == BLOCK_EMPTY)
+    {
+        return 0;
+    }
+    else if (block->type == BLOCK_FULL)
+    {
+        return index;
+    }
+    else if (block->type == BLOCK_PLAIN)
+    {
+        uint64_t const *words = hybrid->words + block->offset * BLOCK_WORDS;
+        size_t subblock = index / (SUBBLOCK_WORDS * WORD_BITS);
+        size_t rank = hybrid->subranks[block->offset * SUBBLOCK_NUMBER + subblock];
+        for (size_t w = subblock * SUBBLOCK_WORDS; w < index / WORD_BITS; ++w)
+        {
+            rank += __builtin_popcountll(words[w]);
+        }
+        if (index % WORD_BITS)
+        {
+            rank += __builtin_popcountll(words[index / WORD_BITS] << (WORD_BITS - index % WORD_BITS));
+        }
+        return rank;
+    }
+    else if (block->type == BLOCK_SPARSE)
+    {
+        return count_positions_below(hybrid->entries + block->offset, block->count, index);
+    }
+
+    // Find the last run starting before `index` and count its ones up to `index`.
+    uint16_t const *runs = hybrid->entries + block->offset;
+    size_t low = 0;
+    size_t high = block->count;
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        if (runs[middle * RUN_ENTRIES] < index)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    if (!low)
+    {
+        return 0;
+    }
+    uint16_t const *run = runs + (low - 1) * RUN_ENTRIES;
+    size_t run_length = (size_t)run[1] - run[0] + 1;
+    size_t covered = index - run[0];
+    return run[2] + (covered < run_length ? covered : run_length);
+}
+
+static size_t block_select(HybridVector const *hybrid, HybridBlock *block, size_t index, bool target)
+{
+    // Find the `index`-th target bit, relative to the block.
+    if (block->type == BLOCK_EMPTY || block->type == BLOCK_FULL)
+    {
+        return index;
+    }
+    else if (block->type == BLOCK_PLAIN)
+    {
+        return plain_select(hybrid, block, index, target);
+    }
+
+    // Positions and runs are searched by the number of target bits before them, which is the
+    // number of ones or the number of zeros in front.
+    uint16_t const *entries = hybrid->entries + block->offset;
+    size_t stride = block->type == BLOCK_SPARSE ? 1 : RUN_ENTRIES;
+    size_t low = 0;
+    size_t high = block->count;
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        uint16_t const *entry = entries + middle * stride;
+        size_t ones_before = block->type == BLOCK_SPARSE ? middle : entry[2];
+        if ((target ? ones_before : entry[0] - ones_before) <= index)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    // For ones, finish in the last entry with at most `index` ones before it. For zeros, add
+    // all ones of the entries with at most `index` zeros before them.
+    if (target)
+    {
+        uint16_t const *entry = entries + (low - 1) * stride;
+        return block->type == BLOCK_SPARSE ? entry[0] : entry[0] + index - entry[2];
+    }
+    if (!low || block->type == BLOCK_SPARSE)
+    {
+        return index + low;
+    }
+    uint16_t const *run = entries + (low - 1) * RUN_ENTRIES;
+    return index + run[2] + run[1] - run[0] + 1;
+}
+
+static size_t plain_select(HybridVector const *hybrid, HybridBlock *block, size_t index, bool target)
+{
+    // Binary search subblocks, then scan words of the one containing the target bit.
+    uint64_t const *words = hybrid->words + block->offset * BLOCK_WORDS;
+    uint16_t const *subranks = hybrid->subranks + block->offset * SUBBLOCK_NUMBER;
+    size_t low = 0;
+    size_t high = SUBBLOCK_NUMBER - 1;
+    while (low < high)
+    {
+        size_t middle = low + (high - low + 1) / 2;
+        size_t rank = target ? subranks[middle] : middle * SUBBLOCK_WORDS * WORD_BITS - subranks[middle];
+        if (rank <= index)
+        {
+            low = middle;
+        }
+        else
+        {
+            high = middle - 1;
+        }
+    }
+
+    index -= target ? subranks[low] : low * SUBBLOCK_WORDS * WORD_BITS - subranks[low];
+    size_t word = low * SUBBLOCK_WORDS;
+    uint64_t bits = target ? words[word] : ~words[word];
+    size_t target_num = __builtin_popcountll(bits);
+    while (index >= target_num)
+    {
+        index -= target_num;
+        ++word;
+        bits = target ? words[word] : ~words[word];
+        target_num = __builtin_popcountll(bits);
+    }
+    return word * WORD_BITS + select_in_word(bits, index);
+}
+
+static size_t count_positions_below(uint16_t const *positions, size_t n, size_t index)
+{
+    size_t low = 0;
+    size_t high = n;
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        if (positions[middle] < index)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+static void fill_plain(HybridVector *hybrid, uint64_t const *words, size_t block, size_t plain)
+{
+    // Copy the words, leaving those past the end as 0, and record subblock ranks.
+    uint64_t *block_words = hybrid->words + plain * BLOCK_WORDS;
+    size_t word_num = block_word_number(hybrid->length, block);
+    for (size_t w = 0; w < word_num; ++w)
+    {
+        block_words[w] = read_word(words, hybrid->length, block * BLOCK_WORDS + w);
+    }
+    size_t rank = 0;
+    for (size_t w = 0; w < BLOCK_WORDS; ++w)
+    {
+        if (!(w % SUBBLOCK_WORDS))
+        {
+            hybrid->subranks[plain * SUBBLOCK_NUMBER + w / SUBBLOCK_WORDS] = rank;
+        }
+        rank += __builtin_popcountll(block_words[w]);
+    }
+}
+
+static void fill_positions(uint64_t const *words, size_t length, size_t block, uint16_t *positions)
+{
+    size_t word_num = block_word_number(length, block);
+    size_t n = 0;
+    for (size_t w = 0; w < word_num; ++w)
+    {
+        uint64_t word = read_word(words, length, block * BLOCK_WORDS + w);
+        while (word)
+        {
+            positions[n++] = w * WORD_BITS + __builtin_ctzll(word);
+            word &= word - 1;
+        }
+    }
+}
+
+static size_t fill_runs(uint64_t const *words, size_t length, size_t block, uint16_t *runs)
+{
+    // Record runs if `runs` is given, and return their number.
+    RunRecord record = {runs, 0, 0};
+    size_t word_num = block_word_number(length, block);
+    return scan_runs(words, length, block * BLOCK_WORDS, word_num, runs ? record_run : NULL, &record);
+}
+
+static void record_run(void *context, size_t start, size_t end)
+{
+    RunRecord *record = context;
+    uint16_t *run = record->runs + record->run_number++ * RUN_ENTRIES;
+    run[0] = start;
+    run[1] = end - 1;
+    run[2] = record->one_number;
+    record->one_number += end - start;
+}
+
+static size_t block_word_number(size_t length, size_t block)
+{
+    size_t word_num = word_number(length) - block * BLOCK_WORDS;
+    return word_num < BLOCK_WORDS ? word_num : BLOCK_WORDS;
+}
@@ -0,0 +1,29 @@
+#ifndef HYBRID_H
+#define HYBRID_H 1
+
+#include "../include/bit_vector.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// A bit string split into blocks of 65536 bits, each stored as plain words, a list of the
+// positions of its ones, a list of its runs of ones, or nothing at all when it is all zeros
+// or all ones, whichever takes the least space. A single directory of blocks records their
+// ranks for both rank and select queries.
+typedef struct HybridVector HybridVector;
+
+// Encode `length` bits packed in `words`.
+HybridVector *construct_hybrid_vector(uint64_t const *words, size_t length);
+void destruct_hybrid_vector(HybridVector *hybrid);
+
+size_t hybrid_rank_one(HybridVector const *hybrid, size_t index);
+size_t hybrid_select(HybridVector const *hybrid, size_t index, bool target);
+
+// The number of bytes used by the directory of blocks and the ranks inside plain blocks.
+size_t hybrid_rank_directory_size(HybridVector const *hybrid);
+
+// Add the bytes used by every component to `bytes`, indexed by `SpaceComponent`.
+void hybrid_space_usage(HybridVector const *hybrid, size_t *bytes);
+
+#endif
@@ -0,0 +1,182 @@
+#define _GNU_SOURCE
+#include "numa.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+// Threads look up their node again after this many calls of `bv_numa_current_node`.
+#define NODE_REFRESH_CALLS 4096
+
+// Policy and flag values of `mbind`, which the C library does not define.
+#define MPOL_BIND 2
+#define MPOL_MF_MOVE (1 << 1)
+
+#define MAX_NODE_NUMBER 1024
+#define LONG_BITS (8 * sizeof(unsigned long))
+
+/********** Declarations of Private Functions **********/
+
+typedef struct NodeRun NodeRun;
+
+static bool read_list(char const *path, bool *members, size_t member_number, size_t *max_member);
+static void *run_node_task(void *node_run);
+
+/********** Definitions of Public Functions **********/
+
+struct NodeRun
+{
+    void (*run)(void *context);
+    void *context;
+};
+
+static _Thread_local size_t current_node;
+static _Thread_local size_t calls_to_refresh;
+
+// The topology set by `bv_numa_override_topology`, if the node number is not 0.
+static size_t override_node_number;
+static size_t override_current_node;
+
+size_t bv_numa_node_number(void)
+{
+    if (override_node_number)
+    {
+        return override_node_number;
+    }
+    size_t max_node;
+    if (!read_list("/sys/devices/system/node/online", NULL, 0, &max_node))
+    {
+        return 1;
+    }
+    return max_node + 1 < MAX_NODE_NUMBER ? max_node + 1 : MAX_NODE_NUMBER;
+}
+
+size_t bv_numa_current_node(void)
+{
+    if (override_node_number)
+    {
+        return override_current_node;
+    }
+    if (!calls_to_refresh)
+    {
+        unsigned cpu;
+        unsigned node;
+        current_node = syscall(SYS_getcpu, &cpu, &node, NULL) ? 0 : node;
+        calls_to_refresh = NODE_REFRESH_CALLS;
+    }
+    --calls_to_refresh;
+    return current_node;
+}
+
+void bv_numa_bind(void const *data, size_t size, size_t node)
+{
+#ifdef SYS_mbind
+    if (!size || node >= MAX_NODE_NUMBER)
+    {
+        return;
+    }
+    uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)data & ~(page_size - 1);
+    uintptr_t end = ((uintptr_t)data + size + page_size - 1) & ~(page_size - 1);
+    unsigned long mask[MAX_NODE_NUMBER / LONG_BITS] = {0};
+    mask[node / LONG_BITS] = 1UL << (node % LONG_BITS);
+    syscall(SYS_mbind, start, end - start, MPOL_BIND, mask, MAX_NODE_NUMBER, MPOL_MF_MOVE);
+#else
+    (void)data;
+    (void)size;
+    (void)node;
+#endif
+}
+
+void bv_numa_run_on_node(size_t node, void (*run)(void *context), void *context)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%zu/cpulist", node);
+    bool cpus[CPU_SETSIZE] = {false};
+    size_t max_cpu;
+    NodeRun node_run = {run, context};
+    pthread_t thread;
+    pthread_attr_t attr;
+    if (!read_list(path, cpus, CPU_SETSIZE, &max_cpu) || pthread_attr_init(&attr))
+    {
+        run(context);
+        return;
+    }
+
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for (size_t cpu = 0; cpu <= max_cpu && cpu < CPU_SETSIZE; ++cpu)
+    {
+        if (cpus[cpu])
+        {
+            CPU_SET(cpu, &cpu_set);
+        }
+    }
+    if (pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpu_set) ||
+        pthread_create(&thread, &attr, run_node_task, &node_run))
+    {
+        pthread_attr_destroy(&attr);
+        run(context);
+        return;
+    }
+    pthread_join(thread, NULL);
+    pthread_attr_destroy(&attr);
+}
+
+#ifdef BIT_VECTOR_TESTING
+void bv_numa_override_topology(size_t node_number, size_t current_node)
+{
+    override_node_number = node_number;
+    override_current_node = current_node;
+}
+#endif
+
+/********** Definitions for Private Functions **********/
+
+static bool read_list(char const *path, bool *members, size_t member_number, size_t *max_member)
+{
+    // Parse a list such as "0-3,8,10-11", marking the members below `member_number` and
+    // finding the largest one. Returns false if the list is missing or empty.
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        return false;
+    }
+    bool found = false;
+    *max_member = 0;
+    size_t first;
+    while (fscanf(file, "%zu", &first) == 1)
+    {
+        size_t last = first;
+        int separator = fgetc(file);
+        if (separator == '-' && fscanf(file, "%zu", &last) == 1)
+        {
+            separator = fgetc(file);
+        }
+        for (size_t member = first; member <= last && member < member_number; ++member)
+        {
+            members[member] = true;
+        }
+        *max_member = last > *max_member ? last : *max_member;
+        found = true;
+        if (separator != ',')
+        {
+            break;
+        }
+    }
+    fclose(file);
+    return found;
+}
+
+static void *run_node_task(void *node_run)
+{
+    NodeRun *self = node_run;
+    self->run(self->context);
+    return NULL;
+}
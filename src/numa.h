@@ -0,0 +1,36 @@
+#ifndef NUMA_H
+#define NUMA_H 1
+
+#include <stddef.h>
+
+// Placement of memory and threads on NUMA nodes, read from sysfs and done with system calls
+// directly, so that nothing beyond the C library is needed. Names start with `bv_` so that
+// they do not clash with libnuma in programs linking both. Machines or kernels without NUMA
+// support look like a single node, where all of these do nothing.
+
+// The number of nodes, counting up to the highest online one.
+size_t bv_numa_node_number(void);
+
+// The node of the CPU running the calling thread, looked up again every few thousand calls
+// since threads may migrate.
+size_t bv_numa_current_node(void);
+
+// Move the pages overlapping `size` bytes at `data` to `node` and keep them there. This is
+// only a hint, which is silently ignored when the kernel refuses it. The memory must be mapped
+// for the caller alone, such as by `mmap`, since the policy covers whole pages and stays on them
+// after they are reused by malloc.
+void bv_numa_bind(void const *data, size_t size, size_t node);
+
+// Call `run` with `context` on a thread allowed only on the CPUs of `node`, so that the
+// memory it touches first is allocated there, and wait for it. Runs on the calling thread
+// when the CPUs of `node` are unknown.
+void bv_numa_run_on_node(size_t node, void (*run)(void *context), void *context);
+
+#ifdef BIT_VECTOR_TESTING
+// Pretend that there are `node_number` nodes and that all threads run on `current_node`, so
+// that tests cover the paths for several nodes on any machine. A node number of 0 restores the
+// real topology. Only built into the unit tests, never into the library.
+void bv_numa_override_topology(size_t node_number, size_t current_node);
+#endif
+
+#endif
@@ -0,0 +1,86 @@
+#include "parallel.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/********** Declarations of Private Functions **********/
+
+typedef struct ParallelRun ParallelRun;
+typedef struct Worker Worker;
+
+static void *run_worker(void *worker);
+
+/********** Definitions of Public Functions **********/
+
+struct ParallelRun
+{
+    ParallelTask run;
+    void *context;
+    size_t task_number;
+
+    // Threads take the next task from this counter, which balances tasks of uneven cost.
+    atomic_size_t next_task;
+};
+
+struct Worker
+{
+    ParallelRun *parallel_run;
+    size_t thread;
+};
+
+void run_parallel(size_t thread_number, size_t task_number, ParallelTask run, void *context)
+{
+    if (thread_number > task_number)
+    {
+        thread_number = task_number;
+    }
+    if (thread_number <= 1)
+    {
+        for (size_t task = 0; task < task_number; ++task)
+        {
+            run(context, task, 0);
+        }
+        return;
+    }
+
+    ParallelRun parallel_run = {run, context, task_number, 0};
+    pthread_t *threads = malloc((thread_number - 1) * sizeof(pthread_t));
+    Worker *workers = malloc(thread_number * sizeof(Worker));
+    for (size_t thread = 0; thread < thread_number; ++thread)
+    {
+        workers[thread].parallel_run = &parallel_run;
+        workers[thread].thread = thread;
+    }
+
+    // The calling thread works as thread 0. If a thread cannot be created, the threads
+    // started so far take all tasks from the shared counter instead.
+    size_t started = 1;
+    while (started < thread_number && !pthread_create(&threads[started - 1], NULL, run_worker, &workers[started]))
+    {
+        ++started;
+    }
+    run_worker(&workers[0]);
+    for (size_t thread = 1; thread < started; ++thread)
+    {
+        pthread_join(threads[thread - 1], NULL);
+    }
+
+    free(workers);
+    free(threads);
+}
+
+/********** Definitions for Private Functions **********/
+
+static void *run_worker(void *worker)
+{
+    Worker *self = worker;
+    ParallelRun *parallel_run = self->parallel_run;
+    size_t task;
+    while ((task = atomic_fetch_add(&parallel_run->next_task, 1)) < parallel_run->task_number)
+    {
+        parallel_run->run(parallel_run->context, task, self->thread);
+    }
+    return NULL;
+}
@@ -0,0 +1,15 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H 1
+
+#include <stddef.h>
+
+// A task receives the index of the thread running it, which is always less than the
+// number of threads, so that tasks can use per-thread resources without locking.
+typedef void (*ParallelTask)(void *context, size_t task, size_t thread);
+
+// Run tasks `0` to `task_number - 1` on `thread_number` threads including the calling one,
+// and return when all of them are finished. Zero or one thread runs every task in order
+// on the calling thread.
+void run_parallel(size_t thread_number, size_t task_number, ParallelTask run, void *context);
+
+#endif
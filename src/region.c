@@ -0,0 +1,111 @@
+#include "region.h"
+#include "numa.h"
+#include "huge_page.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/********** Declarations of Private Functions **********/
+
+static size_t round_to_pages(Region const *region, size_t size);
+
+/********** Definitions of `Region` and Public Functions **********/
+
+struct Region
+{
+    uint8_t *data;
+    size_t reserved_size;
+    size_t committed_size;
+
+    // Commits are rounded up to whole pages of this size.
+    size_t page_size;
+};
+
+Region *construct_region(size_t reserved_size, bool huge_pages)
+{
+    // Inaccessible pages take no memory until they are committed. Reservations of huge pages
+    // are aligned by reserving one more huge page and unmapping the ends around the aligned
+    // part, and grow by whole huge pages.
+    Region *region = malloc(sizeof(Region));
+    region->page_size = huge_pages && reserved_size >= HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE : (size_t)sysconf(_SC_PAGESIZE);
+    reserved_size = round_to_pages(region, reserved_size ? reserved_size : 1);
+    size_t alignment = region->page_size == HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE : 0;
+    uint8_t *mapping = mmap(NULL, reserved_size + alignment, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                            -1, 0);
+    if (mapping == MAP_FAILED)
+    {
+        free(region);
+        return NULL;
+    }
+    region->data = mapping;
+    if (alignment)
+    {
+        region->data = (uint8_t *)huge_page_round((uintptr_t)mapping);
+        size_t head = region->data - mapping;
+        if (head)
+        {
+            munmap(mapping, head);
+        }
+        munmap(region->data + reserved_size, alignment - head);
+        huge_page_advise(region->data, reserved_size);
+    }
+    region->reserved_size = reserved_size;
+    region->committed_size = 0;
+    return region;
+}
+
+void destruct_region(Region *region)
+{
+    munmap(region->data, region->reserved_size);
+    free(region);
+}
+
+void *region_data(Region *region)
+{
+    return region->data;
+}
+
+bool region_commit(Region *region, size_t size)
+{
+    if (size <= region->committed_size)
+    {
+        return true;
+    }
+    if (size > region->reserved_size)
+    {
+        return false;
+    }
+
+    // At least double the committed size, within the reservation.
+    size_t doubled_size = 2 * region->committed_size;
+    size_t committed_size = round_to_pages(region, size > doubled_size ? size : doubled_size);
+    committed_size = committed_size < region->reserved_size ? committed_size : region->reserved_size;
+    if (mprotect(region->data + region->committed_size, committed_size - region->committed_size,
+                 PROT_READ | PROT_WRITE))
+    {
+        return false;
+    }
+    region->committed_size = committed_size;
+    return true;
+}
+
+size_t region_size(Region *region)
+{
+    return region->committed_size;
+}
+
+void region_bind(Region *region, size_t node)
+{
+    bv_numa_bind(region->data, region->reserved_size, node);
+}
+
+/********** Definitions for Private Functions **********/
+
+static size_t round_to_pages(Region const *region, size_t size)
+{
+    return (size + region->page_size - 1) / region->page_size * region->page_size;
+}
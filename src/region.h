@@ -0,0 +1,29 @@
+#ifndef REGION_H
+#define REGION_H 1
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Address space reserved up front and committed as it is used, so that the contents grow in
+// place and never move.
+typedef struct Region Region;
+
+// Reserve `reserved_size` bytes. With `huge_pages`, reservations of at least a huge page are
+// aligned to huge pages and asked to be backed by them. Returns NULL on failure.
+Region *construct_region(size_t reserved_size, bool huge_pages);
+void destruct_region(Region *region);
+
+void *region_data(Region *region);
+
+// Make at least the first `size` bytes usable, zero-filled where they are new. Commits grow
+// geometrically so that a series of small growths only takes a few system calls. Returns
+// false if `size` exceeds the reservation or the memory cannot be committed.
+bool region_commit(Region *region, size_t size);
+
+// The number of bytes committed.
+size_t region_size(Region *region);
+
+// Place the whole reservation on NUMA node `node`, including pages committed later, as a hint.
+void region_bind(Region *region, size_t node);
+
+#endif
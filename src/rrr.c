@@ -0,0 +1,269 @@
+#include "rrr.h"
+#include "word.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#define WORD_BITS 64
+#define MAX_BLOCK_LENGTH 63
+
+// Every superblock of this many blocks records the number of ones before it and the start
+// of its offsets, so queries decode at most one superblock of classes.
+#define SUPERBLOCK_BLOCKS 32
+
+/********** Declarations of Private Functions **********/
+
+static uint64_t binomial(RrrVector const *rrr, size_t n, size_t k);
+static uint64_t encode_block(RrrVector const *rrr, uint64_t bits, size_t class);
+static uint64_t decode_block(RrrVector const *rrr, size_t class, uint64_t offset, size_t limit);
+static size_t block_bit_number(RrrVector const *rrr, size_t block);
+
+/********** Definitions of `RrrVector` and Public Functions **********/
+
+struct RrrVector
+{
+    size_t length;
+    size_t block_length;
+    size_t block_number;
+
+    // `binomials[n * (block_length + 1) + k]` is the binomial coefficient C(n, k) for `n` and
+    // `k` up to the block length, and offsets of class `k` take `offset_widths[k]` bits.
+    uint64_t *binomials;
+    uint8_t offset_widths[MAX_BLOCK_LENGTH + 1];
+
+    // Classes are packed with `class_width` bits each, while offsets are packed one after
+    // another with the widths of their classes.
+    size_t class_width;
+    uint64_t *classes;
+    uint64_t *offsets;
+
+    // The sampled rank directory, with one more superblock at the end for the totals. Every
+    // superblock is a pair of the number of ones before it and the start of its offsets, so
+    // that both sit in the same cache line.
+    size_t superblock_number;
+    size_t *superblocks;
+};
+
+RrrVector *construct_rrr_vector(uint64_t const *words, size_t length, size_t block_length)
+{
+    RrrVector *rrr = malloc(sizeof(RrrVector));
+    rrr->length = length;
+    rrr->block_length = block_length;
+    rrr->block_number = (length + block_length - 1) / block_length;
+
+    // Build Pascal's triangle up to the block length.
+    size_t side = block_length + 1;
+    rrr->binomials = calloc(side * side, sizeof(uint64_t));
+    for (size_t n = 0; n <= block_length; ++n)
+    {
+        rrr->binomials[n * side] = 1;
+        for (size_t k = 1; k <= n; ++k)
+        {
+            rrr->binomials[n * side + k] = rrr->binomials[(n - 1) * side + k - 1] + rrr->binomials[(n - 1) * side + k];
+        }
+    }
+    for (size_t k = 0; k <= block_length; ++k)
+    {
+        uint64_t max_offset = binomial(rrr, block_length, k) - 1;
+        rrr->offset_widths[k] = max_offset ? WORD_BITS - __builtin_clzll(max_offset) : 0;
+    }
+    rrr->class_width = WORD_BITS - __builtin_clzll(block_length);
+
+    // Find classes first to size the offsets.
+    rrr->classes = calloc(word_number(rrr->block_number * rrr->class_width) + 1, sizeof(uint64_t));
+    size_t offset_bits = 0;
+    for (size_t block = 0; block < rrr->block_number; ++block)
+    {
+        size_t class = __builtin_popcountll(read_bits(words, length, block * block_length, block_length));
+        write_field(rrr->classes, block * rrr->class_width, rrr->class_width, class);
+        offset_bits += rrr->offset_widths[class];
+    }
+
+    // Encode offsets, sampling ranks and offset positions at every superblock.
+    rrr->offsets = calloc(word_number(offset_bits) + 1, sizeof(uint64_t));
+    rrr->superblock_number = (rrr->block_number + SUPERBLOCK_BLOCKS - 1) / SUPERBLOCK_BLOCKS;
+    rrr->superblocks = malloc((rrr->superblock_number + 1) * 2 * sizeof(size_t));
+    size_t rank = 0;
+    size_t position = 0;
+    for (size_t block = 0; block < rrr->block_number; ++block)
+    {
+        if (!(block % SUPERBLOCK_BLOCKS))
+        {
+            rrr->superblocks[2 * (block / SUPERBLOCK_BLOCKS)] = rank;
+            rrr->superblocks[2 * (block / SUPERBLOCK_BLOCKS) + 1] = position;
+        }
+        uint64_t bits = read_bits(words, length, block * block_length, block_length);
+        size_t class = read_field(rrr->classes, block * rrr->class_width, rrr->class_width);
+        write_field(rrr->offsets, position, rrr->offset_widths[class], encode_block(rrr, bits, class));
+        rank += class;
+        position += rrr->offset_widths[class];
+    }
+    rrr->superblocks[2 * rrr->superblock_number] = rank;
+    rrr->superblocks[2 * rrr->superblock_number + 1] = position;
+
+    return rrr;
+}
+
+void destruct_rrr_vector(RrrVector *rrr)
+{
+    free(rrr->binomials);
+    free(rrr->classes);
+    free(rrr->offsets);
+    free(rrr->superblocks);
+    free(rrr);
+}
+
+size_t rrr_rank_one(RrrVector const *rrr, size_t index)
+{
+    if (index >= rrr->length)
+    {
+        return rrr->superblocks[2 * rrr->superblock_number];
+    }
+
+    // Add ranks in previous superblocks, then walk classes of previous blocks in this one.
+    size_t block = index / rrr->block_length;
+    size_t superblock = block / SUPERBLOCK_BLOCKS;
+    size_t rank = rrr->superblocks[2 * superblock];
+    size_t position = rrr->superblocks[2 * superblock + 1];
+    for (size_t b = superblock * SUPERBLOCK_BLOCKS; b < block; ++b)
+    {
+        size_t class = read_field(rrr->classes, b * rrr->class_width, rrr->class_width);
+        rank += class;
+        position += rrr->offset_widths[class];
+    }
+
+    // Decode only the bits of the final block before `index`.
+    size_t remaining = index % rrr->block_length;
+    if (remaining)
+    {
+        size_t class = read_field(rrr->classes, block * rrr->class_width, rrr->class_width);
+        uint64_t offset = read_field(rrr->offsets, position, rrr->offset_widths[class]);
+        uint64_t bits = decode_block(rrr, class, offset, remaining);
+        rank += __builtin_popcountll(bits & (((uint64_t)1 << remaining) - 1));
+    }
+    return rank;
+}
+
+size_t rrr_select(RrrVector const *rrr, size_t index, bool target)
+{
+    // Binary search superblocks for the last one starting with at most `index` target bits.
+    size_t superblock_bits = SUPERBLOCK_BLOCKS * rrr->block_length;
+    size_t low = 0;
+    size_t high = rrr->superblock_number - 1;
+    while (low < high)
+    {
+        size_t middle = low + (high - low + 1) / 2;
+        size_t rank = rrr->superblocks[2 * middle];
+        rank = target ? rank : middle * superblock_bits - rank;
+        if (rank <= index)
+        {
+            low = middle;
+        }
+        else
+        {
+            high = middle - 1;
+        }
+    }
+
+    // Walk classes to the block containing the target bit.
+    size_t rank = target ? rrr->superblocks[2 * low] : low * superblock_bits - rrr->superblocks[2 * low];
+    size_t position = rrr->superblocks[2 * low + 1];
+    size_t block = low * SUPERBLOCK_BLOCKS;
+    size_t class = read_field(rrr->classes, block * rrr->class_width, rrr->class_width);
+    size_t target_num = target ? class : block_bit_number(rrr, block) - class;
+    while (rank + target_num <= index)
+    {
+        rank += target_num;
+        position += rrr->offset_widths[class];
+        ++block;
+        class = read_field(rrr->classes, block * rrr->class_width, rrr->class_width);
+        target_num = target ? class : block_bit_number(rrr, block) - class;
+    }
+
+    // Finish in the decoded block.
+    size_t bit_num = block_bit_number(rrr, block);
+    uint64_t offset = read_field(rrr->offsets, position, rrr->offset_widths[class]);
+    uint64_t bits = decode_block(rrr, class, offset, rrr->block_length);
+    bits = target ? bits : ~bits & (((uint64_t)1 << bit_num) - 1);
+    return block * rrr->block_length + select_in_word(bits, index - rank);
+}
+
+size_t rrr_rank_directory_size(RrrVector const *rrr)
+{
+    return (rrr->superblock_number + 1) * 2 * sizeof(size_t);
+}
+
+void rrr_space_usage(RrrVector const *rrr, size_t *bytes)
+{
+    // Classes and offsets together take the place of the bits, and the select queries use
+    // the rank directory without structures of their own.
+    size_t class_words = word_number(rrr->block_number * rrr->class_width) + 1;
+    size_t offset_words = word_number(rrr->superblocks[2 * rrr->superblock_number + 1]) + 1;
+    bytes[SPACE_PAYLOAD] += (class_words + offset_words) * sizeof(uint64_t);
+    bytes[SPACE_RANK_BLOCKS] += rrr_rank_directory_size(rrr);
+    bytes[SPACE_LOOKUP_TABLES] += (rrr->block_length + 1) * (rrr->block_length + 1) * sizeof(uint64_t);
+    bytes[SPACE_ALLOCATOR_OVERHEAD] += sizeof(RrrVector);
+}
+
+/********** Definitions for Private Functions **********/
+
+static uint64_t binomial(RrrVector const *rrr, size_t n, size_t k)
+{
+    return k <= n ? rrr->binomials[n * (rrr->block_length + 1) + k] : 0;
+}
+
+static uint64_t encode_block(RrrVector const *rrr, uint64_t bits, size_t class)
+{
+    // Blocks of a class are ordered so that, at every position, those with the bit unset
+    // come first, and there are C(remaining positions, remaining ones) of them.
+    uint64_t offset = 0;
+    size_t one_num = class;
+    for (size_t i = 0; one_num; ++i)
+    {
+        if (bits >> i & 1)
+        {
+            offset += binomial(rrr, rrr->block_length - i - 1, one_num);
+            --one_num;
+        }
+    }
+    return offset;
+}
+
+static uint64_t decode_block(RrrVector const *rrr, size_t class, uint64_t offset, size_t limit)
+{
+    // Decode the bits of a block from its class and offset, stopping after the first
+    // `limit` positions.
+    if (class == rrr->block_length)
+    {
+        return ((uint64_t)1 << class) - 1;
+    }
+    uint64_t bits = 0;
+    size_t one_num = class;
+    for (size_t i = 0; one_num && i < limit; ++i)
+    {
+        if (!offset)
+        {
+            // The remaining ones sit at the end of the block.
+            bits |= (((uint64_t)1 << one_num) - 1) << (rrr->block_length - one_num);
+            break;
+        }
+        uint64_t unset_num = binomial(rrr, rrr->block_length - i - 1, one_num);
+        if (offset >= unset_num)
+        {
+            bits |= (uint64_t)1 << i;
+            offset -= unset_num;
+            --one_num;
+        }
+    }
+    return bits;
+}
+
+static size_t block_bit_number(RrrVector const *rrr, size_t block)
+{
+    // Only the last block may be shorter than the others.
+    size_t start = block * rrr->block_length;
+    return rrr->length - start < rrr->block_length ? rrr->length - start : rrr->block_length;
+}
@@ -0,0 +1,28 @@
+#ifndef RRR_H
+#define RRR_H 1
+
+#include "../include/bit_vector.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// An RRR encoded bit string, which stores the number of ones of every block as its class and
+// the index of the block among those of its class as its offset, so that low-entropy bit
+// strings take space close to their zeroth-order entropy.
+typedef struct RrrVector RrrVector;
+
+// Encode `length` bits packed in `words` with blocks of `block_length` bits, from 1 to 63.
+RrrVector *construct_rrr_vector(uint64_t const *words, size_t length, size_t block_length);
+void destruct_rrr_vector(RrrVector *rrr);
+
+size_t rrr_rank_one(RrrVector const *rrr, size_t index);
+size_t rrr_select(RrrVector const *rrr, size_t index, bool target);
+
+// The number of bytes used by the sampled rank directory.
+size_t rrr_rank_directory_size(RrrVector const *rrr);
+
+// Add the bytes used by every component to `bytes`, indexed by `SpaceComponent`.
+void rrr_space_usage(RrrVector const *rrr, size_t *bytes);
+
+#endif
@@ -0,0 +1,138 @@
+#include "run_length.h"
+#include "elias_fano.h"
+#include "word.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// The boundaries of runs being recorded, and the number of ones before the next run.
+typedef struct RunRecord
+{
+    size_t *starts;
+    size_t *ranks;
+    size_t run_number;
+    size_t one_number;
+} RunRecord;
+
+/********** Declarations of Private Functions **********/
+
+static void record_run(void *context, size_t start, size_t end);
+static size_t run_start(RunLengthVector const *rl, size_t run);
+static size_t ones_before_run(RunLengthVector const *rl, size_t run);
+
+/********** Definitions of `RunLengthVector` and Public Functions **********/
+
+struct RunLengthVector
+{
+    size_t length;
+    size_t one_number;
+    size_t run_number;
+
+    // The positions where runs of ones start, and the number of ones before every run.
+    EliasFanoVector *starts;
+    EliasFanoVector *ranks;
+};
+
+RunLengthVector *construct_run_length_vector(uint64_t const *words, size_t length)
+{
+    // Count runs first to size the boundaries, then record them in a second scan.
+    RunLengthVector *rl = malloc(sizeof(RunLengthVector));
+    rl->length = length;
+    rl->run_number = scan_runs(words, length, 0, word_number(length), NULL, NULL);
+    RunRecord record = {0};
+    record.starts = malloc((rl->run_number + 1) * sizeof(size_t));
+    record.ranks = malloc((rl->run_number + 1) * sizeof(size_t));
+    scan_runs(words, length, 0, word_number(length), record_run, &record);
+    rl->one_number = record.one_number;
+
+    rl->starts = construct_elias_fano_vector(record.starts, rl->run_number, length);
+    rl->ranks = construct_elias_fano_vector(record.ranks, rl->run_number, rl->one_number);
+    free(record.starts);
+    free(record.ranks);
+    return rl;
+}
+
+void destruct_run_length_vector(RunLengthVector *rl)
+{
+    destruct_elias_fano_vector(rl->starts);
+    destruct_elias_fano_vector(rl->ranks);
+    free(rl);
+}
+
+size_t run_length_rank_one(RunLengthVector const *rl, size_t index)
+{
+    // Find the last run starting before `index`, which covers all ones up to it except for
+    // those of the run past `index`.
+    size_t run_num = elias_fano_rank_one(rl->starts, index);
+    if (!run_num)
+    {
+        return 0;
+    }
+    size_t run = run_num - 1;
+    size_t rank = ones_before_run(rl, run);
+    size_t run_length = ones_before_run(rl, run + 1) - rank;
+    size_t covered = index - run_start(rl, run);
+    return rank + (covered < run_length ? covered : run_length);
+}
+
+size_t run_length_select(RunLengthVector const *rl, size_t index, bool target)
+{
+    if (target)
+    {
+        // The target one is in the last run with at most `index` ones before it.
+        size_t run = elias_fano_rank_one(rl->ranks, index + 1) - 1;
+        return run_start(rl, run) + index - ones_before_run(rl, run);
+    }
+
+    // Binary search for the number of runs starting after at most `index` zeros, all of
+    // which come before the target zero.
+    size_t low = 0;
+    size_t high = rl->run_number;
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        if (run_start(rl, middle) - ones_before_run(rl, middle) <= index)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return index + ones_before_run(rl, low);
+}
+
+size_t run_length_rank_directory_size(RunLengthVector const *rl)
+{
+    return elias_fano_rank_directory_size(rl->starts);
+}
+
+void run_length_space_usage(RunLengthVector const *rl, size_t *bytes)
+{
+    elias_fano_space_usage(rl->starts, bytes);
+    elias_fano_space_usage(rl->ranks, bytes);
+    bytes[SPACE_ALLOCATOR_OVERHEAD] += sizeof(RunLengthVector);
+}
+
+/********** Definitions for Private Functions **********/
+
+static void record_run(void *context, size_t start, size_t end)
+{
+    RunRecord *record = context;
+    record->starts[record->run_number] = start;
+    record->ranks[record->run_number++] = record->one_number;
+    record->one_number += end - start;
+}
+
+static size_t run_start(RunLengthVector const *rl, size_t run)
+{
+    return elias_fano_select(rl->starts, run, true);
+}
+
+static size_t ones_before_run(RunLengthVector const *rl, size_t run)
+{
+    return run < rl->run_number ? elias_fano_select(rl->ranks, run, true) : rl->one_number;
+}
@@ -0,0 +1,28 @@
+#ifndef RUN_LENGTH_H
+#define RUN_LENGTH_H 1
+
+#include "../include/bit_vector.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// A run-length encoded bit string, which stores the start of every run of ones and the number
+// of ones before it as two Elias-Fano sequences, so that its space grows with the number of
+// runs rather than with the length.
+typedef struct RunLengthVector RunLengthVector;
+
+// Encode `length` bits packed in `words`.
+RunLengthVector *construct_run_length_vector(uint64_t const *words, size_t length);
+void destruct_run_length_vector(RunLengthVector *rl);
+
+size_t run_length_rank_one(RunLengthVector const *rl, size_t index);
+size_t run_length_select(RunLengthVector const *rl, size_t index, bool target);
+
+// The number of bytes used by the samples that rank queries use.
+size_t run_length_rank_directory_size(RunLengthVector const *rl);
+
+// Add the bytes used by every component to `bytes`, indexed by `SpaceComponent`.
+void run_length_space_usage(RunLengthVector const *rl, size_t *bytes);
+
+#endif
@@ -0,0 +1,530 @@
+#include "../include/bit_vector.h"
+#include "word.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define WORD_BITS 64
+
+// Versions share blocks of this many words, and updates copy the blocks they touch.
+#define BLOCK_WORDS 64
+#define BLOCK_BITS (BLOCK_WORDS * WORD_BITS)
+#define BLOCK_BITS_LOG 12
+
+// Blocks are the leaves of a tree whose inner nodes have this many children, and updates
+// copy the nodes on the paths to the blocks they touch.
+#define NODE_CHILDREN_BITS 6
+#define NODE_CHILDREN (1 << NODE_CHILDREN_BITS)
+
+// Blocks and nodes start with the serial number of the version that allocated them, so that
+// an update copies each of them at most once.
+typedef struct Block
+{
+    size_t serial;
+
+    // The number of ones before every word of the block. Bits past the end are always 0.
+    uint16_t ranks[BLOCK_WORDS];
+    uint64_t words[BLOCK_WORDS];
+} Block;
+
+// Every child of a node is stored next to the number of ones under the children before it, so that a
+// query reads both from one cache line.
+typedef struct NodeEntry
+{
+    size_t rank;
+    void *child;
+} NodeEntry;
+
+typedef struct Node
+{
+    size_t serial;
+
+    // The last entry holds the total number of ones without a child. Children past the end
+    // of the bit string are NULL and have all ones before them.
+    NodeEntry entries[NODE_CHILDREN + 1];
+} Node;
+
+/********** Declarations of Private Functions **********/
+
+static SnapshotVersion *construct_version(size_t length);
+static void destruct_version(SnapshotVersion *version, bool owns_blocks);
+static void destruct_tree(void *tree, size_t height);
+static void *copy_once(SnapshotVersion *version, SnapshotVersion *old, void **slot, size_t size);
+static void count_block(Block *block);
+static size_t block_one_number(Block const *block);
+static Block const *find_block(SnapshotVersion const *version, size_t index, size_t *rank);
+static size_t child_shift(SnapshotVersion const *version, size_t depth);
+static size_t version_one_number(SnapshotVersion const *version);
+static void retire_version(SnapshotBitVector *sbv, SnapshotVersion *version, size_t epoch);
+static void reclaim_versions(SnapshotBitVector *sbv);
+static size_t select_target(BitVectorSnapshot snapshot, size_t index, bool target);
+static void check_index(SnapshotVersion const *version, size_t index, size_t limit);
+static size_t block_number(size_t length);
+
+/********** Definitions of `SnapshotBitVector` and Public Functions **********/
+
+struct SnapshotVersion
+{
+    size_t length;
+    size_t serial;
+
+    // The root of a tree of `height` levels of nodes above the blocks. Nodes and blocks may be
+    // shared with older and newer versions.
+    size_t height;
+    void *root;
+
+    // Once replaced, a version waits in a list for readers of epochs up to `retired_epoch` to
+    // leave, then frees the nodes and blocks that the next version copied.
+    size_t retired_epoch;
+    size_t garbage_number;
+    void **garbage;
+    SnapshotVersion *next_retired;
+};
+
+struct SnapshotBitVector
+{
+    _Atomic(SnapshotVersion *) current;
+
+    // Readers count themselves in the counter of the parity of the epoch they entered in.
+    // The writer only moves the epoch on once the readers of the previous epoch, which share
+    // the counter of the next one, have all left.
+    atomic_size_t epoch;
+    atomic_size_t reader_numbers[2];
+
+    // Updates and reclamation are serialized, and readers only try to reclaim when there are
+    // retired versions, without waiting for the lock.
+    pthread_mutex_t writer_mutex;
+    atomic_bool has_retired;
+    SnapshotVersion *retired_head;
+    SnapshotVersion *retired_tail;
+};
+
+SnapshotBitVector *construct_snapshot_bit_vector_from_words(uint64_t const *words, size_t length)
+{
+    // Build the blocks, then every level of nodes over the level below, up to the root.
+    SnapshotVersion *version = construct_version(length);
+    size_t word_num = word_number(length);
+    size_t child_num = block_number(length);
+    void **children = malloc(child_num * sizeof(void *));
+    for (size_t b = 0; b < child_num; ++b)
+    {
+        Block *block = calloc(1, sizeof(Block));
+        size_t first_word = b * BLOCK_WORDS;
+        size_t count = word_num - first_word < BLOCK_WORDS ? word_num - first_word : BLOCK_WORDS;
+        for (size_t w = 0; w < count; ++w)
+        {
+            block->words[w] = read_word(words, length, first_word + w);
+        }
+        count_block(block);
+        children[b] = block;
+    }
+    for (size_t level = 0; level < version->height; ++level)
+    {
+        // Nodes replace their children in place, which are all read by then.
+        size_t node_num = (child_num + NODE_CHILDREN - 1) / NODE_CHILDREN;
+        for (size_t i = 0; i < node_num; ++i)
+        {
+            Node *node = calloc(1, sizeof(Node));
+            size_t rank = 0;
+            for (size_t c = 0; c < NODE_CHILDREN; ++c)
+            {
+                size_t child = i * NODE_CHILDREN + c;
+                node->entries[c].rank = rank;
+                if (child < child_num)
+                {
+                    node->entries[c].child = children[child];
+                    rank += level ? ((Node *)children[child])->entries[NODE_CHILDREN].rank : block_one_number(children[child]);
+                }
+            }
+            node->entries[NODE_CHILDREN].rank = rank;
+            children[i] = node;
+        }
+        child_num = node_num;
+    }
+    version->root = children[0];
+    free(children);
+
+    SnapshotBitVector *sbv = malloc(sizeof(SnapshotBitVector));
+    atomic_init(&sbv->current, version);
+    atomic_init(&sbv->epoch, 0);
+    atomic_init(&sbv->reader_numbers[0], 0);
+    atomic_init(&sbv->reader_numbers[1], 0);
+    pthread_mutex_init(&sbv->writer_mutex, NULL);
+    atomic_init(&sbv->has_retired, false);
+    sbv->retired_head = NULL;
+    sbv->retired_tail = NULL;
+    return sbv;
+}
+
+void destruct_snapshot_bit_vector(SnapshotBitVector *sbv)
+{
+    // Retired versions only own the nodes and blocks replaced after them, and the current
+    // version owns its whole tree.
+    while (sbv->retired_head)
+    {
+        SnapshotVersion *next = sbv->retired_head->next_retired;
+        destruct_version(sbv->retired_head, false);
+        sbv->retired_head = next;
+    }
+    destruct_version(atomic_load_explicit(&sbv->current, memory_order_relaxed), true);
+    pthread_mutex_destroy(&sbv->writer_mutex);
+    free(sbv);
+}
+
+BitVectorSnapshot acquire_snapshot(SnapshotBitVector *sbv)
+{
+    // Enter the current epoch, retrying if it moves on before we are counted in it, so that
+    // the writer never frees a version we may load.
+    size_t epoch = atomic_load(&sbv->epoch);
+    atomic_fetch_add(&sbv->reader_numbers[epoch % 2], 1);
+    while (atomic_load(&sbv->epoch) != epoch)
+    {
+        atomic_fetch_sub(&sbv->reader_numbers[epoch % 2], 1);
+        epoch = atomic_load(&sbv->epoch);
+        atomic_fetch_add(&sbv->reader_numbers[epoch % 2], 1);
+    }
+
+    BitVectorSnapshot snapshot;
+    snapshot.version = atomic_load(&sbv->current);
+    snapshot.epoch = epoch;
+    return snapshot;
+}
+
+void release_snapshot(SnapshotBitVector *sbv, BitVectorSnapshot snapshot)
+{
+    atomic_fetch_sub(&sbv->reader_numbers[snapshot.epoch % 2], 1);
+    if (atomic_load_explicit(&sbv->has_retired, memory_order_relaxed) && !pthread_mutex_trylock(&sbv->writer_mutex))
+    {
+        reclaim_versions(sbv);
+        pthread_mutex_unlock(&sbv->writer_mutex);
+    }
+}
+
+void update_bits(SnapshotBitVector *sbv, BitUpdate const *updates, size_t n)
+{
+    if (!n)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&sbv->writer_mutex);
+    SnapshotVersion *old = atomic_load_explicit(&sbv->current, memory_order_relaxed);
+    for (size_t i = 0; i < n; ++i)
+    {
+        check_index(old, updates[i].index, old->length);
+    }
+
+    // Share the whole tree with the old version, and copy the nodes and the block on the path
+    // to every changed bit the first time the path is taken, so at most `height + 1` of them
+    // per update.
+    SnapshotVersion *version = construct_version(old->length);
+    version->serial = old->serial + 1;
+    version->root = old->root;
+    old->garbage = malloc(n * (old->height + 1) * sizeof(void *));
+    old->garbage_number = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        size_t index = updates[i].index;
+        bool bit = updates[i].bit;
+        size_t word = index % BLOCK_BITS / WORD_BITS;
+        uint64_t mask = (uint64_t)1 << (index % WORD_BITS);
+        size_t rank;
+        if (!(find_block(version, index, &rank)->words[word] & mask) == !bit)
+        {
+            continue;
+        }
+
+        // Move the ranks after the bit by one on the way down.
+        void **slot = &version->root;
+        for (size_t depth = 0; depth < version->height; ++depth)
+        {
+            Node *node = copy_once(version, old, slot, sizeof(Node));
+            size_t child = index >> child_shift(version, depth) & (NODE_CHILDREN - 1);
+            for (size_t c = child + 1; c <= NODE_CHILDREN; ++c)
+            {
+                node->entries[c].rank = bit ? node->entries[c].rank + 1 : node->entries[c].rank - 1;
+            }
+            slot = &node->entries[child].child;
+        }
+        Block *block = copy_once(version, old, slot, sizeof(Block));
+        block->words[word] ^= mask;
+        for (size_t w = word + 1; w < BLOCK_WORDS; ++w)
+        {
+            block->ranks[w] = bit ? block->ranks[w] + 1 : block->ranks[w] - 1;
+        }
+    }
+
+    // Publish the new version, then retire the old one in the epoch that may still read it.
+    atomic_store(&sbv->current, version);
+    retire_version(sbv, old, atomic_load(&sbv->epoch));
+    reclaim_versions(sbv);
+    pthread_mutex_unlock(&sbv->writer_mutex);
+}
+
+size_t snapshot_length(BitVectorSnapshot snapshot)
+{
+    return snapshot.version->length;
+}
+
+bool snapshot_get_bit(BitVectorSnapshot snapshot, size_t index)
+{
+    check_index(snapshot.version, index, snapshot.version->length);
+    size_t rank;
+    Block const *block = find_block(snapshot.version, index, &rank);
+    return block->words[index % BLOCK_BITS / WORD_BITS] >> (index % WORD_BITS) & 1;
+}
+
+size_t snapshot_rank_one(BitVectorSnapshot snapshot, size_t index)
+{
+    SnapshotVersion const *version = snapshot.version;
+    if (index >= version->length)
+    {
+        return version_one_number(version);
+    }
+
+    size_t rank;
+    Block const *block = find_block(version, index, &rank);
+    size_t word = index % BLOCK_BITS / WORD_BITS;
+    size_t offset = index % WORD_BITS;
+    rank += block->ranks[word];
+    return rank + __builtin_popcountll(block->words[word] & (((uint64_t)1 << offset) - 1));
+}
+
+size_t snapshot_rank_zero(BitVectorSnapshot snapshot, size_t index)
+{
+    index = index < snapshot.version->length ? index : snapshot.version->length;
+    return index - snapshot_rank_one(snapshot, index);
+}
+
+size_t snapshot_select_one(BitVectorSnapshot snapshot, size_t index)
+{
+    return select_target(snapshot, index, true);
+}
+
+size_t snapshot_select_zero(BitVectorSnapshot snapshot, size_t index)
+{
+    return select_target(snapshot, index, false);
+}
+
+/********** Definitions for Private Functions **********/
+
+static SnapshotVersion *construct_version(size_t length)
+{
+    // Use at least one level of nodes, so that the root is always a node.
+    SnapshotVersion *version = malloc(sizeof(SnapshotVersion));
+    version->length = length;
+    version->serial = 0;
+    version->height = 1;
+    for (size_t capacity = NODE_CHILDREN; capacity < block_number(length); capacity *= NODE_CHILDREN)
+    {
+        ++version->height;
+    }
+    version->root = NULL;
+    version->garbage_number = 0;
+    version->garbage = NULL;
+    version->next_retired = NULL;
+    return version;
+}
+
+static void destruct_version(SnapshotVersion *version, bool owns_blocks)
+{
+    if (owns_blocks)
+    {
+        destruct_tree(version->root, version->height);
+    }
+    for (size_t i = 0; i < version->garbage_number; ++i)
+    {
+        free(version->garbage[i]);
+    }
+    free(version->garbage);
+    free(version);
+}
+
+static void destruct_tree(void *tree, size_t height)
+{
+    if (height)
+    {
+        Node *node = tree;
+        for (size_t c = 0; c < NODE_CHILDREN && node->entries[c].child; ++c)
+        {
+            destruct_tree(node->entries[c].child, height - 1);
+        }
+    }
+    free(tree);
+}
+
+static void *copy_once(SnapshotVersion *version, SnapshotVersion *old, void **slot, size_t size)
+{
+    // Copy a node or block allocated by an older version into the new one, leaving the
+    // original for the old version to free.
+    size_t const *serial = *slot;
+    if (*serial != version->serial)
+    {
+        void *copy = malloc(size);
+        memcpy(copy, *slot, size);
+        *(size_t *)copy = version->serial;
+        old->garbage[old->garbage_number++] = *slot;
+        *slot = copy;
+    }
+    return *slot;
+}
+
+static void count_block(Block *block)
+{
+    size_t rank = 0;
+    for (size_t w = 0; w < BLOCK_WORDS; ++w)
+    {
+        block->ranks[w] = rank;
+        rank += __builtin_popcountll(block->words[w]);
+    }
+}
+
+static size_t block_one_number(Block const *block)
+{
+    return block->ranks[BLOCK_WORDS - 1] + __builtin_popcountll(block->words[BLOCK_WORDS - 1]);
+}
+
+static Block const *find_block(SnapshotVersion const *version, size_t index, size_t *rank)
+{
+    // Descend to the block containing `index`, adding the ones before it to `rank`.
+    void const *tree = version->root;
+    *rank = 0;
+    for (size_t depth = 0; depth < version->height; ++depth)
+    {
+        Node const *node = tree;
+        size_t child = index >> child_shift(version, depth) & (NODE_CHILDREN - 1);
+        *rank += node->entries[child].rank;
+        tree = node->entries[child].child;
+    }
+    return tree;
+}
+
+static size_t child_shift(SnapshotVersion const *version, size_t depth)
+{
+    // The base-2 logarithm of the number of bits under every child of a node at `depth`.
+    return BLOCK_BITS_LOG + NODE_CHILDREN_BITS * (version->height - 1 - depth);
+}
+
+static size_t version_one_number(SnapshotVersion const *version)
+{
+    return ((Node const *)version->root)->entries[NODE_CHILDREN].rank;
+}
+
+static void retire_version(SnapshotBitVector *sbv, SnapshotVersion *version, size_t epoch)
+{
+    version->retired_epoch = epoch;
+    if (sbv->retired_tail)
+    {
+        sbv->retired_tail->next_retired = version;
+    }
+    else
+    {
+        sbv->retired_head = version;
+    }
+    sbv->retired_tail = version;
+    atomic_store_explicit(&sbv->has_retired, true, memory_order_relaxed);
+}
+
+static void reclaim_versions(SnapshotBitVector *sbv)
+{
+    // Readers of epoch `e - 1` share the counter of epoch `e + 1`. Once they have left, free
+    // the versions retired before epoch `e`, which readers of later epochs never loaded, and
+    // move on to epoch `e + 1`.
+    while (sbv->retired_head)
+    {
+        size_t epoch = atomic_load(&sbv->epoch);
+        if (atomic_load(&sbv->reader_numbers[(epoch + 1) % 2]))
+        {
+            break;
+        }
+        while (sbv->retired_head && sbv->retired_head->retired_epoch < epoch)
+        {
+            SnapshotVersion *next = sbv->retired_head->next_retired;
+            destruct_version(sbv->retired_head, false);
+            sbv->retired_head = next;
+        }
+        if (!sbv->retired_head)
+        {
+            sbv->retired_tail = NULL;
+            atomic_store_explicit(&sbv->has_retired, false, memory_order_relaxed);
+        }
+        atomic_store(&sbv->epoch, epoch + 1);
+    }
+}
+
+static size_t select_target(BitVectorSnapshot snapshot, size_t index, bool target)
+{
+    SnapshotVersion const *version = snapshot.version;
+    size_t one_num = version_one_number(version);
+    size_t target_num = target ? one_num : version->length - one_num;
+    check_index(version, index, target_num);
+
+    // Descend through the last child starting with at most `index` target bits on every
+    // level, where children past the end never qualify, then find the last such word of the
+    // block.
+    void const *tree = version->root;
+    size_t start = 0;
+    for (size_t depth = 0; depth < version->height; ++depth)
+    {
+        Node const *node = tree;
+        size_t child_bits = (size_t)1 << child_shift(version, depth);
+        size_t low = 0;
+        size_t high = NODE_CHILDREN - 1;
+        while (low < high)
+        {
+            size_t middle = low + (high - low + 1) / 2;
+            size_t rank = target ? node->entries[middle].rank : middle * child_bits - node->entries[middle].rank;
+            if (rank <= index)
+            {
+                low = middle;
+            }
+            else
+            {
+                high = middle - 1;
+            }
+        }
+        index -= target ? node->entries[low].rank : low * child_bits - node->entries[low].rank;
+        start += low * child_bits;
+        tree = node->entries[low].child;
+    }
+    Block const *block = tree;
+
+    size_t low = 0;
+    size_t high = BLOCK_WORDS - 1;
+    while (low < high)
+    {
+        size_t middle = low + (high - low + 1) / 2;
+        size_t rank = target ? block->ranks[middle] : middle * WORD_BITS - block->ranks[middle];
+        if (rank <= index)
+        {
+            low = middle;
+        }
+        else
+        {
+            high = middle - 1;
+        }
+    }
+    index -= target ? block->ranks[low] : low * WORD_BITS - block->ranks[low];
+    uint64_t word = target ? block->words[low] : ~block->words[low];
+    return start + low * WORD_BITS + select_in_word(word, index);
+}
+
+static void check_index(SnapshotVersion const *version, size_t index, size_t limit)
+{
+    if (index >= limit)
+    {
+        fprintf(stderr, "Error: Index %zu is out of range for a snapshot of %zu bits.\n", index, version->length);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static size_t block_number(size_t length)
+{
+    return length ? (length + BLOCK_BITS - 1) / BLOCK_BITS : 1;
+}
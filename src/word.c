@@ -0,0 +1,216 @@
+#include "word.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define HAS_X86_DISPATCH 1
+#endif
+
+#define WORD_BITS 64
+
+/********** Declarations of Private Functions **********/
+
+static size_t select_in_word_broadword(uint64_t word, size_t index);
+#ifdef HAS_X86_DISPATCH
+static void detect_cpu_features(void) __attribute__((constructor));
+static size_t select_in_word_bmi2(uint64_t word, size_t index) __attribute__((target("bmi,bmi2")));
+#endif
+
+/********** Definitions of Public Functions **********/
+
+#ifdef HAS_X86_DISPATCH
+// Whether the CPU supports POPCNT, PDEP, PEXT and TZCNT, and AVX2, detected once at load time.
+static bool has_popcnt = false;
+static bool has_bmi2 = false;
+static bool has_avx2 = false;
+#endif
+
+bool cpu_has_popcnt(void)
+{
+#ifdef HAS_X86_DISPATCH
+    return has_popcnt;
+#else
+    return false;
+#endif
+}
+
+bool cpu_has_bmi2(void)
+{
+#ifdef HAS_X86_DISPATCH
+    return has_bmi2;
+#else
+    return false;
+#endif
+}
+
+bool cpu_has_avx2(void)
+{
+#ifdef HAS_X86_DISPATCH
+    return has_avx2;
+#else
+    return false;
+#endif
+}
+
+size_t select_in_word(uint64_t word, size_t index)
+{
+#ifdef HAS_X86_DISPATCH
+    if (has_bmi2)
+    {
+        return select_in_word_bmi2(word, index);
+    }
+#endif
+    return select_in_word_broadword(word, index);
+}
+
+uint64_t read_field(uint64_t const *words, size_t start, size_t width)
+{
+    if (!width)
+    {
+        return 0;
+    }
+    size_t word = start / WORD_BITS;
+    size_t offset = start % WORD_BITS;
+    uint64_t value = words[word] >> offset;
+    if (offset + width > WORD_BITS)
+    {
+        value |= words[word + 1] << (WORD_BITS - offset);
+    }
+    return value & (((uint64_t)1 << width) - 1);
+}
+
+void write_field(uint64_t *words, size_t start, size_t width, uint64_t value)
+{
+    if (!width)
+    {
+        return;
+    }
+    size_t word = start / WORD_BITS;
+    size_t offset = start % WORD_BITS;
+    words[word] |= value << offset;
+    if (offset + width > WORD_BITS)
+    {
+        words[word + 1] |= value >> (WORD_BITS - offset);
+    }
+}
+
+size_t word_number(size_t length)
+{
+    return (length + WORD_BITS - 1) / WORD_BITS;
+}
+
+uint64_t read_word(uint64_t const *words, size_t length, size_t word)
+{
+    if ((word + 1) * WORD_BITS > length)
+    {
+        return words[word] & (((uint64_t)1 << (length % WORD_BITS)) - 1);
+    }
+    return words[word];
+}
+
+uint64_t read_bits(uint64_t const *words, size_t length, size_t start, size_t count)
+{
+    if (start >= length || !count)
+    {
+        return 0;
+    }
+    count = length - start < count ? length - start : count;
+    size_t word = start / WORD_BITS;
+    size_t offset = start % WORD_BITS;
+    uint64_t value = words[word] >> offset;
+    if (offset + count > WORD_BITS)
+    {
+        value |= words[word + 1] << (WORD_BITS - offset);
+    }
+    return count < WORD_BITS ? value & (((uint64_t)1 << count) - 1) : value;
+}
+
+size_t scan_runs(uint64_t const *words, size_t length, size_t first_word, size_t word_num, RunVisitor visit,
+                 void *context)
+{
+    // A run starts at every one following a zero, and ends at every zero following a one.
+    size_t run_num = 0;
+    size_t run_start = 0;
+    uint64_t carry = 0;
+    for (size_t w = 0; w < word_num; ++w)
+    {
+        uint64_t word = read_word(words, length, first_word + w);
+        uint64_t boundaries = word ^ (word << 1 | carry);
+        carry = word >> (WORD_BITS - 1);
+        if (!visit)
+        {
+            run_num += __builtin_popcountll(word & boundaries);
+            continue;
+        }
+        while (boundaries)
+        {
+            size_t position = w * WORD_BITS + __builtin_ctzll(boundaries);
+            if (word >> (position % WORD_BITS) & 1)
+            {
+                run_start = position;
+            }
+            else
+            {
+                visit(context, run_start, position);
+                ++run_num;
+            }
+            boundaries &= boundaries - 1;
+        }
+    }
+
+    // Close the run reaching the end of the scan.
+    if (carry && visit)
+    {
+        visit(context, run_start, word_num * WORD_BITS);
+        ++run_num;
+    }
+    return run_num;
+}
+
+/********** Definitions for Private Functions **********/
+
+static size_t select_in_word_broadword(uint64_t word, size_t index)
+{
+    // Vigna's broadword select. First compute the cumulative number of ones of every byte,
+    // where byte `i` of `byte_sums` counts the ones in bytes 0 to `i`.
+    uint64_t const ones_step_4 = 0x1111111111111111;
+    uint64_t const ones_step_8 = 0x0101010101010101;
+    uint64_t const msbs_step_8 = 0x80 * ones_step_8;
+    uint64_t byte_sums = word - ((word & 0xA * ones_step_4) >> 1);
+    byte_sums = (byte_sums & 3 * ones_step_4) + ((byte_sums >> 2) & 3 * ones_step_4);
+    byte_sums = (byte_sums + (byte_sums >> 4)) & 0x0F * ones_step_8;
+    byte_sums *= ones_step_8;
+
+    // Compare all cumulative counts with `index` in parallel to find the byte of the target.
+    uint64_t index_step_8 = index * ones_step_8;
+    uint64_t leq_step_8 = ((index_step_8 | msbs_step_8) - byte_sums) & msbs_step_8;
+    size_t place = __builtin_popcountll(leq_step_8) * 8;
+    size_t byte_rank = index - (((byte_sums << 8) >> place) & 0xFF);
+
+    // Finish in the byte.
+    uint64_t byte = (word >> place) & 0xFF;
+    for (size_t i = 0; i < byte_rank; ++i)
+    {
+        byte &= byte - 1;
+    }
+    return place + __builtin_ctzll(byte);
+}
+
+#ifdef HAS_X86_DISPATCH
+static void detect_cpu_features(void)
+{
+    __builtin_cpu_init();
+    has_popcnt = __builtin_cpu_supports("popcnt");
+    has_bmi2 = __builtin_cpu_supports("bmi2");
+    has_avx2 = __builtin_cpu_supports("avx2");
+}
+
+static size_t select_in_word_bmi2(uint64_t word, size_t index)
+{
+    // Deposit a single bit onto the `index`-th set bit of `word` and locate it.
+    return _tzcnt_u64(_pdep_u64((uint64_t)1 << index, word));
+}
+#endif
@@ -0,0 +1,39 @@
+#ifndef WORD_H
+#define WORD_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Whether the CPU supports POPCNT, BMI2 and AVX2, detected once at load time.
+bool cpu_has_popcnt(void);
+bool cpu_has_bmi2(void);
+bool cpu_has_avx2(void);
+
+// Find the position of the `index`-th set bit of `word`, which must exist.
+size_t select_in_word(uint64_t word, size_t index);
+
+// Read or write a field of fewer than 64 bits starting from bit `start` of packed words.
+// Fields may cross into the next word, and writes expect zeroed space.
+uint64_t read_field(uint64_t const *words, size_t start, size_t width);
+void write_field(uint64_t *words, size_t start, size_t width, uint64_t value);
+
+// The number of words holding `length` bits.
+size_t word_number(size_t length);
+
+// Read word `word` of packed words holding `length` bits, with bits past the end as 0.
+uint64_t read_word(uint64_t const *words, size_t length, size_t word);
+
+// Read at most 64 bits starting from bit `start` of packed words holding `length` bits, which
+// may cross into the next word, with bits past the end as 0.
+uint64_t read_bits(uint64_t const *words, size_t length, size_t start, size_t count);
+
+// Called with the start and the end (exclusive) of a run of ones, relative to the first bit scanned.
+typedef void (*RunVisitor)(void *context, size_t start, size_t end);
+
+// Scan `word_num` words from word `first_word` of packed words holding `length` bits for runs of
+// ones, and return their number. Every run is passed to `visit` in order unless it is NULL.
+size_t scan_runs(uint64_t const *words, size_t length, size_t first_word, size_t word_num, RunVisitor visit,
+                 void *context);
+
+#endif
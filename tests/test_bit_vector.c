@@ -1,5 +1,13 @@
 #include "unity.h"
 #include "bit_vector.h"
+#include "../src/numa.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 char const *const BIT_STR = "01010101_01010101_01010101_01010101_01010101_01010101_01010101_01010101";
 
@@ -91,6 +99,1022 @@ void test_select_zero_short_block(void)
     TEST_ASSERT_EQUAL(expected, index);
 }
 
+void test_construct_from_words(void)
+{
+    // The same bit string as `BIT_STR`, packed with bit `i` at position `i % 64`.
+    uint64_t words[] = {0xAAAAAAAAAAAAAAAA};
+
+    BitVector *copied = construct_bit_vector_from_words(words, 64, false);
+    BitVector *borrowed = construct_bit_vector_from_words(words, 64, true);
+    for (size_t i = 0; i <= 64; ++i)
+    {
+        TEST_ASSERT_EQUAL(rank_one(bv, i), rank_one(copied, i));
+        TEST_ASSERT_EQUAL(rank_one(bv, i), rank_one(borrowed, i));
+    }
+    for (size_t i = 0; i < 32; ++i)
+    {
+        TEST_ASSERT_EQUAL(select_one(bv, i), select_one(copied, i));
+        TEST_ASSERT_EQUAL(select_zero(bv, i), select_zero(borrowed, i));
+    }
+    destruct_bit_vector(copied);
+    destruct_bit_vector(borrowed);
+
+    // The borrowed buffer is left untouched.
+    TEST_ASSERT_EQUAL_HEX64(0xAAAAAAAAAAAAAAAA, words[0]);
+}
+
+void test_construct_from_read_only_words(void)
+{
+    // Construction only reads a borrowed buffer, so it may be write-protected.
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    uint64_t *words = mmap(NULL, page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    TEST_ASSERT_TRUE(words != MAP_FAILED);
+    for (size_t i = 0; i < page_size / sizeof(uint64_t); ++i)
+    {
+        words[i] = 0x0123456789ABCDEF * (i + 1);
+    }
+    mprotect(words, page_size, PROT_READ);
+
+    size_t length = page_size * 8 - 3;
+    BitVector *borrowed = construct_bit_vector_from_words(words, length, true);
+    BitVector *copied = construct_bit_vector_from_words(words, length, false);
+    size_t one_num = rank_one(copied, length);
+    TEST_ASSERT_EQUAL(one_num, rank_one(borrowed, length));
+    for (size_t i = 0; i < one_num; i += 7)
+    {
+        TEST_ASSERT_EQUAL(select_one(copied, i), select_one(borrowed, i));
+    }
+    for (size_t i = 0; i < length - one_num; i += 7)
+    {
+        TEST_ASSERT_EQUAL(select_zero(copied, i), select_zero(borrowed, i));
+    }
+    destruct_bit_vector(borrowed);
+    destruct_bit_vector(copied);
+    munmap(words, page_size);
+}
+
+void test_parse_with_separators(void)
+{
+    // Build a string of 300 bits with separators scattered across the 64-character
+    // blocks the parser works on, and compare it with the packed words.
+    uint64_t words[5] = {0};
+    char bits_str[512];
+    size_t length = 0;
+    for (size_t i = 0; i < 300; ++i)
+    {
+        if (i % 7 == 3)
+        {
+            bits_str[length++] = i % 2 ? '_' : ' ';
+        }
+        bool bit = (i * 2654435761u) >> 7 & 1;
+        bits_str[length++] = bit ? '1' : '0';
+        words[i / 64] |= (uint64_t)bit << (i % 64);
+    }
+    bits_str[length] = '\0';
+
+    BitVector *parsed = construct_bit_vector(bits_str);
+    BitVector *packed = construct_bit_vector_from_words(words, 300, true);
+    for (size_t i = 0; i <= 300; ++i)
+    {
+        TEST_ASSERT_EQUAL(rank_one(packed, i), rank_one(parsed, i));
+    }
+    destruct_bit_vector(parsed);
+    destruct_bit_vector(packed);
+}
+
+void test_rank_one_across_words(void)
+{
+    uint64_t words[] = {0xFFFFFFFFFFFFFFFF, 0, 0x8000000000000001, 0xF};
+    BitVector *bv = construct_bit_vector_from_words(words, 196, false);
+
+    TEST_ASSERT_EQUAL(63, rank_one(bv, 63));
+    TEST_ASSERT_EQUAL(64, rank_one(bv, 64));
+    TEST_ASSERT_EQUAL(64, rank_one(bv, 128));
+    TEST_ASSERT_EQUAL(65, rank_one(bv, 129));
+    TEST_ASSERT_EQUAL(65, rank_one(bv, 191));
+    TEST_ASSERT_EQUAL(66, rank_one(bv, 192));
+    TEST_ASSERT_EQUAL(70, rank_one(bv, 196));
+    TEST_ASSERT_EQUAL(126, rank_zero(bv, 196));
+
+    destruct_bit_vector(bv);
+}
+
+void test_rank_one_interleaved_layout(void)
+{
+    BitVectorOptions options = {0};
+    options.rank_layout = RANK_LAYOUT_INTERLEAVED;
+    uint64_t words[] = {0xFFFFFFFFFFFFFFFF, 0, 0, 0, 0, 0, 0, 0x8000000000000001, 0xF};
+    BitVector *interleaved = construct_bit_vector_from_words_with_options(words, 516, false, &options);
+
+    TEST_ASSERT_EQUAL(64, rank_one(interleaved, 448));
+    TEST_ASSERT_EQUAL(65, rank_one(interleaved, 449));
+    TEST_ASSERT_EQUAL(66, rank_one(interleaved, 512));
+    TEST_ASSERT_EQUAL(70, rank_one(interleaved, 516));
+    TEST_ASSERT_EQUAL(4 * sizeof(uint64_t), rank_directory_size(interleaved));
+
+    destruct_bit_vector(interleaved);
+}
+
+void test_select_sampled_mode(void)
+{
+    BitVectorOptions options = {0};
+    options.select_mode = SELECT_MODE_SAMPLED;
+    uint64_t words[64];
+    for (size_t i = 0; i < 64; ++i)
+    {
+        words[i] = 0xAAAAAAAAAAAAAAAA;
+    }
+    BitVector *sampled = construct_bit_vector_from_words_with_options(words, 64 * 64, false, &options);
+
+    TEST_ASSERT_EQUAL(1, select_one(sampled, 0));
+    TEST_ASSERT_EQUAL(2047, select_one(sampled, 1023));
+    TEST_ASSERT_EQUAL(2049, select_one(sampled, 1024));
+    TEST_ASSERT_EQUAL(4095, select_one(sampled, 2047));
+    TEST_ASSERT_EQUAL(0, select_zero(sampled, 0));
+    TEST_ASSERT_EQUAL(2050, select_zero(sampled, 1025));
+    TEST_ASSERT_EQUAL(4094, select_zero(sampled, 2047));
+
+    destruct_bit_vector(sampled);
+}
+
+void test_save_and_map(void)
+{
+    char const *path = "test_bit_vector.bin";
+    TEST_ASSERT_TRUE(save_bit_vector(bv, path));
+    BitVector *mapped = map_bit_vector(path);
+    TEST_ASSERT_NOT_NULL(mapped);
+
+    for (size_t i = 0; i <= 64; ++i)
+    {
+        TEST_ASSERT_EQUAL(rank_one(bv, i), rank_one(mapped, i));
+    }
+    for (size_t i = 0; i < 32; ++i)
+    {
+        TEST_ASSERT_EQUAL(select_one(bv, i), select_one(mapped, i));
+        TEST_ASSERT_EQUAL(select_zero(bv, i), select_zero(mapped, i));
+    }
+
+    destruct_bit_vector(mapped);
+    remove(path);
+}
+
+void test_map_rejects_corrupt_files(void)
+{
+    // Truncated files and headers pointing outside the file or describing impossible
+    // structures are rejected before any structure is read. Samples are only read by
+    // queries, which stay within the bits however corrupt the samples are.
+    char const *path = "test_bit_vector.bin";
+    TEST_ASSERT_TRUE(save_bit_vector(bv, path));
+    FILE *file = fopen(path, "rb");
+    fseek(file, 0, SEEK_END);
+    size_t size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t *saved = malloc(size);
+    TEST_ASSERT_EQUAL(1, fread(saved, size, 1, file));
+    fclose(file);
+
+    // The header holds the magic string, the version, the file size, the length, the rank
+    // layout, the rank block length, the sample numbers and the section offsets.
+    size_t const fields[] = {3, 4, 5, 6, 7, 7, 8, 9, 10, 11, 12};
+    uint64_t const values[] = {1 << 20, 2, 0, 100, 0, 1 << 20, 1 << 20, 3, 1 << 20, 64 + 8, 1 << 20};
+    size_t const field_num = sizeof(fields) / sizeof(size_t);
+    for (size_t i = 0; i < field_num + 2; ++i)
+    {
+        uint8_t *corrupt = malloc(size);
+        memcpy(corrupt, saved, size);
+        uint64_t header[13];
+        memcpy(header, saved, sizeof(header));
+        size_t corrupt_size = size;
+        if (i < field_num)
+        {
+            memcpy(corrupt + fields[i] * sizeof(uint64_t), &values[i], sizeof(uint64_t));
+        }
+        else if (i == field_num)
+        {
+            // Truncate the file, keeping the recorded size consistent.
+            corrupt_size -= 64;
+            header[2] = corrupt_size;
+            memcpy(corrupt, header, sizeof(header));
+        }
+        else
+        {
+            // Move the first sample of ones past the end of the bits.
+            memcpy(corrupt + header[12], &header[3], sizeof(uint64_t));
+        }
+        file = fopen(path, "wb");
+        fwrite(corrupt, corrupt_size, 1, file);
+        fclose(file);
+        BitVector *mapped = map_bit_vector(path);
+        if (i <= field_num)
+        {
+            TEST_ASSERT_NULL(mapped);
+        }
+        else
+        {
+            // Select every one of the 32 under the moved sample.
+            TEST_ASSERT_NOT_NULL(mapped);
+            size_t indexes[32];
+            size_t positions[32];
+            for (size_t q = 0; q < 32; ++q)
+            {
+                indexes[q] = q;
+                TEST_ASSERT_LESS_THAN(header[3], select_one(mapped, q));
+            }
+            select_one_batch(mapped, indexes, 32, positions);
+            for (size_t q = 0; q < 32; ++q)
+            {
+                TEST_ASSERT_LESS_THAN(header[3], positions[q]);
+            }
+            destruct_bit_vector(mapped);
+        }
+        free(corrupt);
+    }
+
+    free(saved);
+    remove(path);
+}
+
+void test_rank_batch(void)
+{
+    size_t indexes[65];
+    size_t ones[65];
+    size_t zeros[65];
+    for (size_t i = 0; i <= 64; ++i)
+    {
+        indexes[i] = (i * 37) % 65;
+    }
+    rank_one_batch(bv, indexes, 65, ones);
+    rank_zero_batch(bv, indexes, 65, zeros);
+
+    for (size_t i = 0; i <= 64; ++i)
+    {
+        TEST_ASSERT_EQUAL(rank_one(bv, indexes[i]), ones[i]);
+        TEST_ASSERT_EQUAL(rank_zero(bv, indexes[i]), zeros[i]);
+    }
+
+    // Batches longer than the prefetch distance, in both layouts.
+    uint64_t words[256];
+    size_t long_indexes[1000];
+    size_t ranks[1000];
+    for (size_t i = 0; i < 256; ++i)
+    {
+        words[i] = 0x0123456789ABCDEF * (i + 1);
+    }
+    for (size_t i = 0; i < 1000; ++i)
+    {
+        long_indexes[i] = (i * 7919) % (256 * 64 + 1);
+    }
+    BitVectorOptions options = {0};
+    for (size_t layout = 0; layout < 2; ++layout)
+    {
+        options.rank_layout = layout;
+        BitVector *layout_bv = construct_bit_vector_from_words_with_options(words, 256 * 64, false, &options);
+        rank_one_batch(layout_bv, long_indexes, 1000, ranks);
+        for (size_t i = 0; i < 1000; ++i)
+        {
+            TEST_ASSERT_EQUAL(rank_one(layout_bv, long_indexes[i]), ranks[i]);
+        }
+        destruct_bit_vector(layout_bv);
+    }
+}
+
+void test_select_batch(void)
+{
+    size_t indexes[32];
+    size_t ones[32];
+    size_t zeros[32];
+    for (size_t i = 0; i < 32; ++i)
+    {
+        indexes[i] = (i * 13) % 32;
+    }
+    select_one_batch(bv, indexes, 32, ones);
+    select_zero_batch(bv, indexes, 32, zeros);
+
+    for (size_t i = 0; i < 32; ++i)
+    {
+        TEST_ASSERT_EQUAL(2 * indexes[i] + 1, ones[i]);
+        TEST_ASSERT_EQUAL(2 * indexes[i], zeros[i]);
+    }
+}
+
+void test_parallel_construction(void)
+{
+    uint64_t words[256];
+    for (size_t i = 0; i < 256; ++i)
+    {
+        words[i] = 0x0123456789ABCDEF * (i + 1);
+    }
+    BitVectorOptions options = {0};
+    BitVector *sequential = construct_bit_vector_from_words_with_options(words, 256 * 64, false, &options);
+    options.thread_number = 4;
+    BitVector *parallel = construct_bit_vector_from_words_with_options(words, 256 * 64, false, &options);
+
+    size_t one_num = rank_one(sequential, 256 * 64);
+    TEST_ASSERT_EQUAL(one_num, rank_one(parallel, 256 * 64));
+    for (size_t i = 0; i <= 256 * 64; i += 37)
+    {
+        TEST_ASSERT_EQUAL(rank_one(sequential, i), rank_one(parallel, i));
+    }
+    for (size_t i = 0; i < one_num; i += 11)
+    {
+        TEST_ASSERT_EQUAL(select_one(sequential, i), select_one(parallel, i));
+    }
+    for (size_t i = 0; i < 256 * 64 - one_num; i += 11)
+    {
+        TEST_ASSERT_EQUAL(select_zero(sequential, i), select_zero(parallel, i));
+    }
+
+    destruct_bit_vector(sequential);
+    destruct_bit_vector(parallel);
+}
+
+typedef struct LazySelectQuery
+{
+    BitVector *bv;
+    size_t one_num;
+    size_t checksum;
+} LazySelectQuery;
+
+static void *query_lazy_select(void *arg)
+{
+    LazySelectQuery *query = arg;
+    query->checksum = 0;
+    for (size_t i = 0; i < query->one_num; i += 13)
+    {
+        query->checksum += select_one(query->bv, i) + select_zero(query->bv, i);
+    }
+    return NULL;
+}
+
+void test_lazy_select(void)
+{
+    uint64_t words[256];
+    for (size_t i = 0; i < 256; ++i)
+    {
+        words[i] = 0xFEDCBA9876543210 * (i + 1);
+    }
+    BitVector *eager = construct_bit_vector_from_words(words, 256 * 64, true);
+    size_t one_num = rank_one(eager, 256 * 64);
+    LazySelectQuery expected = {eager, one_num, 0};
+    query_lazy_select(&expected);
+
+    // The first select queries come from several threads at once.
+    BitVectorOptions options = {0};
+    options.lazy_select = true;
+    options.thread_number = 2;
+    BitVector *lazy = construct_bit_vector_from_words_with_options(words, 256 * 64, true, &options);
+    TEST_ASSERT_EQUAL(one_num, rank_one(lazy, 256 * 64));
+    pthread_t threads[4];
+    LazySelectQuery queries[4];
+    for (size_t i = 0; i < 4; ++i)
+    {
+        queries[i] = (LazySelectQuery){lazy, one_num, 0};
+        pthread_create(&threads[i], NULL, query_lazy_select, &queries[i]);
+    }
+    for (size_t i = 0; i < 4; ++i)
+    {
+        pthread_join(threads[i], NULL);
+        TEST_ASSERT_EQUAL(expected.checksum, queries[i].checksum);
+    }
+
+    // Building select structures explicitly is the same as building them on first use.
+    options.select_mode = SELECT_MODE_SAMPLED;
+    BitVector *sampled = construct_bit_vector_from_words_with_options(words, 256 * 64, true, &options);
+    build_select_structures(sampled);
+    LazySelectQuery query = {sampled, one_num, 0};
+    query_lazy_select(&query);
+    TEST_ASSERT_EQUAL(expected.checksum, query.checksum);
+
+    destruct_bit_vector(eager);
+    destruct_bit_vector(lazy);
+    destruct_bit_vector(sampled);
+}
+
+void test_space_usage(void)
+{
+    uint64_t words[256];
+    for (size_t i = 0; i < 256; ++i)
+    {
+        words[i] = 0x0123456789ABCDEF * (i + 1);
+    }
+    BitVectorOptions options = {0};
+    options.lazy_select = true;
+    BitVector *lazy = construct_bit_vector_from_words_with_options(words, 256 * 64, false, &options);
+
+    // Select structures take no space until they are built.
+    BitVectorSpaceUsage usage = bit_vector_space_usage(lazy);
+    TEST_ASSERT_EQUAL(sizeof(words), usage.bytes[SPACE_PAYLOAD]);
+    TEST_ASSERT_EQUAL(rank_directory_size(lazy), usage.bytes[SPACE_RANK_BLOCKS] + usage.bytes[SPACE_RANK_SUBBLOCKS]);
+    TEST_ASSERT_EQUAL(0, usage.bytes[SPACE_SELECT_ONE]);
+    TEST_ASSERT_EQUAL(0, usage.bytes[SPACE_SELECT_ZERO]);
+    TEST_ASSERT_TRUE(usage.bits_per_bit[SPACE_PAYLOAD] == 1.0);
+
+    select_one(lazy, 0);
+    usage = bit_vector_space_usage(lazy);
+    TEST_ASSERT_TRUE(usage.bytes[SPACE_SELECT_ONE] > 0);
+    TEST_ASSERT_EQUAL(0, usage.bytes[SPACE_SELECT_ZERO]);
+
+    size_t total = 0;
+    for (size_t i = 0; i < SPACE_COMPONENT_NUMBER; ++i)
+    {
+        total += usage.bytes[i];
+    }
+    TEST_ASSERT_EQUAL(total, usage.total_bytes);
+    TEST_ASSERT_TRUE(usage.total_bits_per_bit == 8.0 * total / (256 * 64));
+
+    // Arenas are sized for the rank directory and select samples, leaving little space unused.
+    size_t length = (size_t)1 << 22;
+    uint64_t *large_words = malloc(length / 8);
+    for (size_t i = 0; i < length / 64; ++i)
+    {
+        large_words[i] = 0x0123456789ABCDEF * (i + 1);
+    }
+    options.lazy_select = false;
+    options.select_mode = SELECT_MODE_SAMPLED;
+    for (size_t layout = 0; layout < 2; ++layout)
+    {
+        options.rank_layout = layout;
+        BitVector *sampled = construct_bit_vector_from_words_with_options(large_words, length, false, &options);
+        usage = bit_vector_space_usage(sampled);
+        size_t structures = usage.bytes[SPACE_RANK_BLOCKS] + usage.bytes[SPACE_RANK_SUBBLOCKS] +
+                            usage.bytes[SPACE_SELECT_ONE] + usage.bytes[SPACE_SELECT_ZERO];
+        TEST_ASSERT_TRUE(usage.bytes[SPACE_ALLOCATOR_OVERHEAD] < structures / 10);
+        destruct_bit_vector(sampled);
+    }
+    free(large_words);
+
+    destruct_bit_vector(lazy);
+}
+
+void test_rrr_encoding(void)
+{
+    // A sparse bit string with a dense and an all-ones stretch in the middle.
+    uint64_t words[256];
+    for (size_t i = 0; i < 256; ++i)
+    {
+        words[i] = (uint64_t)1 << (i * 7 % 64);
+    }
+    words[100] = 0x0123456789ABCDEF;
+    words[101] = ~(uint64_t)0;
+    size_t length = 256 * 64 - 5;
+    BitVector *plain = construct_bit_vector_from_words(words, length, true);
+    size_t one_num = rank_one(plain, length);
+
+    size_t const block_lengths[] = {0, 31, 5};
+    for (size_t i = 0; i < 3; ++i)
+    {
+        BitVectorOptions options = {0};
+        options.encoding = ENCODING_RRR;
+        options.rrr_block_length = block_lengths[i];
+        BitVector *rrr = construct_bit_vector_from_words_with_options(words, length, false, &options);
+        for (size_t j = 0; j <= length; j += 3)
+        {
+            TEST_ASSERT_EQUAL(rank_one(plain, j), rank_one(rrr, j));
+        }
+        for (size_t j = 0; j < one_num; ++j)
+        {
+            TEST_ASSERT_EQUAL(select_one(plain, j), select_one(rrr, j));
+        }
+        for (size_t j = 0; j < length - one_num; j += 3)
+        {
+            TEST_ASSERT_EQUAL(select_zero(plain, j), select_zero(rrr, j));
+        }
+        TEST_ASSERT_TRUE(bit_vector_space_usage(rrr).bytes[SPACE_PAYLOAD] < sizeof(words));
+        destruct_bit_vector(rrr);
+    }
+    destruct_bit_vector(plain);
+}
+
+void test_elias_fano_encoding(void)
+{
+    // Sparse ones with a run at the start, a gap at the end, and positions 0 and 1000.
+    size_t positions[600];
+    size_t one_num = 0;
+    for (size_t i = 0; i < 100; ++i)
+    {
+        positions[one_num++] = i;
+    }
+    for (size_t i = 0; i < 500; ++i)
+    {
+        positions[one_num++] = 1000 + i * i * 3 % 97 + i * 97;
+    }
+    size_t length = 60000;
+    BitVector *plain = construct_bit_vector_from_positions(positions, one_num, length, NULL);
+
+    BitVectorOptions options = {0};
+    options.encoding = ENCODING_ELIAS_FANO;
+    BitVector *from_positions = construct_bit_vector_from_positions(positions, one_num, length, &options);
+    uint64_t words[(60000 + 63) / 64] = {0};
+    for (size_t i = 0; i < one_num; ++i)
+    {
+        words[positions[i] / 64] |= (uint64_t)1 << (positions[i] % 64);
+    }
+    BitVector *from_words = construct_bit_vector_from_words_with_options(words, length, true, &options);
+
+    BitVector *efs[] = {from_positions, from_words};
+    for (size_t i = 0; i < 2; ++i)
+    {
+        for (size_t j = 0; j <= length; j += 7)
+        {
+            TEST_ASSERT_EQUAL(rank_one(plain, j), rank_one(efs[i], j));
+        }
+        for (size_t j = 0; j < one_num; ++j)
+        {
+            TEST_ASSERT_EQUAL(positions[j], select_one(efs[i], j));
+        }
+        for (size_t j = 0; j < length - one_num; j += 7)
+        {
+            TEST_ASSERT_EQUAL(select_zero(plain, j), select_zero(efs[i], j));
+        }
+        TEST_ASSERT_TRUE(bit_vector_space_usage(efs[i]).total_bytes < sizeof(words));
+        destruct_bit_vector(efs[i]);
+    }
+    destruct_bit_vector(plain);
+}
+
+void test_run_length_encoding(void)
+{
+    // Runs of growing lengths, crossing words, with a run of ones reaching the end.
+    uint64_t words[512] = {0};
+    size_t length = 512 * 64 - 10;
+    size_t position = 3;
+    for (size_t run = 1; position < length; ++run)
+    {
+        for (size_t i = position; i < position + run * 7 && i < length; ++i)
+        {
+            words[i / 64] |= (uint64_t)1 << (i % 64);
+        }
+        position += run * 7 + run % 5 + 1;
+    }
+    for (size_t i = length - 100; i < length; ++i)
+    {
+        words[i / 64] |= (uint64_t)1 << (i % 64);
+    }
+    BitVector *plain = construct_bit_vector_from_words(words, length, true);
+    size_t one_num = rank_one(plain, length);
+
+    BitVectorOptions options = {0};
+    options.encoding = ENCODING_RUN_LENGTH;
+    BitVector *rl = construct_bit_vector_from_words_with_options(words, length, false, &options);
+    for (size_t j = 0; j <= length + 1; ++j)
+    {
+        TEST_ASSERT_EQUAL(rank_one(plain, j), rank_one(rl, j));
+    }
+    for (size_t j = 0; j < one_num; ++j)
+    {
+        TEST_ASSERT_EQUAL(select_one(plain, j), select_one(rl, j));
+    }
+    for (size_t j = 0; j < length - one_num; ++j)
+    {
+        TEST_ASSERT_EQUAL(select_zero(plain, j), select_zero(rl, j));
+    }
+    TEST_ASSERT_TRUE(bit_vector_space_usage(rl).total_bytes < sizeof(words));
+    destruct_bit_vector(rl);
+    destruct_bit_vector(plain);
+}
+
+void test_hybrid_encoding(void)
+{
+    // Blocks of 65536 bits that are dense, empty, sparse, clustered and full, then a short one.
+    size_t block_words = 1024;
+    size_t length = 5 * block_words * 64 + 1000;
+    uint64_t *words = calloc(6 * block_words, sizeof(uint64_t));
+    uint64_t state = 1;
+    for (size_t i = 0; i < block_words; ++i)
+    {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        words[i] = state;
+    }
+    for (size_t i = 2 * block_words; i < 3 * block_words; i += 3)
+    {
+        words[i] = (uint64_t)1 << (i % 64);
+    }
+    for (size_t i = 3 * block_words * 64; i < 4 * block_words * 64; i += 2000)
+    {
+        for (size_t j = i + 500; j < i + 1500; ++j)
+        {
+            words[j / 64] |= (uint64_t)1 << (j % 64);
+        }
+    }
+    for (size_t i = 4 * block_words; i < 5 * block_words; ++i)
+    {
+        words[i] = ~(uint64_t)0;
+    }
+    words[5 * block_words + 3] = 0xF0F0;
+    BitVector *plain = construct_bit_vector_from_words(words, length, true);
+    size_t one_num = rank_one(plain, length);
+
+    BitVectorOptions options = {0};
+    options.encoding = ENCODING_HYBRID;
+    BitVector *hybrid = construct_bit_vector_from_words_with_options(words, length, false, &options);
+    for (size_t j = 0; j <= length + 1; j += 3)
+    {
+        TEST_ASSERT_EQUAL(rank_one(plain, j), rank_one(hybrid, j));
+    }
+    for (size_t j = 0; j < one_num; j += 3)
+    {
+        TEST_ASSERT_EQUAL(select_one(plain, j), select_one(hybrid, j));
+    }
+    for (size_t j = 0; j < length - one_num; j += 3)
+    {
+        TEST_ASSERT_EQUAL(select_zero(plain, j), select_zero(hybrid, j));
+    }
+
+    // Only the dense block is stored as plain words.
+    TEST_ASSERT_TRUE(bit_vector_space_usage(hybrid).bytes[SPACE_PAYLOAD] < 2 * block_words * sizeof(uint64_t));
+    destruct_bit_vector(hybrid);
+    destruct_bit_vector(plain);
+    free(words);
+}
+
+void test_dynamic_bit_vector(void)
+{
+    // Apply random updates to a dynamic bit vector and an array of bits alike, growing past
+    // several leaf splits and shrinking through merges, and compare them along the way.
+    size_t capacity = 20000;
+    bool *bits = calloc(capacity, sizeof(bool));
+    uint64_t words[64] = {0};
+    size_t length = 4000;
+    uint64_t state = 7;
+    for (size_t i = 0; i < length; ++i)
+    {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        bits[i] = state >> 63;
+        words[i / 64] |= (uint64_t)bits[i] << (i % 64);
+    }
+    DynamicBitVector *dbv = construct_dynamic_bit_vector_from_words(words, length);
+    for (size_t step = 0; step < 30000; ++step)
+    {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        size_t index = (state >> 33) % (length + 1);
+        bool bit = state >> 32 & 1;
+        size_t op = (state >> 16) % 100;
+        if (op < (step < 15000 ? 70 : 20))
+        {
+            dynamic_insert_bit(dbv, index, bit);
+            memmove(&bits[index + 1], &bits[index], (length - index) * sizeof(bool));
+            bits[index] = bit;
+            ++length;
+        }
+        else if (index < length && op < 90)
+        {
+            TEST_ASSERT_EQUAL(bits[index], dynamic_delete_bit(dbv, index));
+            memmove(&bits[index], &bits[index + 1], (length - index - 1) * sizeof(bool));
+            --length;
+        }
+        else if (index < length)
+        {
+            dynamic_flip_bit(dbv, index);
+            bits[index] = !bits[index];
+        }
+
+        if (step % 3000 == 0 || step == 29999)
+        {
+            size_t one_num = 0;
+            for (size_t i = 0; i < length; ++i)
+            {
+                TEST_ASSERT_EQUAL(one_num, dynamic_rank_one(dbv, i));
+                if (bits[i])
+                {
+                    TEST_ASSERT_EQUAL(i, dynamic_select_one(dbv, one_num));
+                }
+                else
+                {
+                    TEST_ASSERT_EQUAL(i, dynamic_select_zero(dbv, i - one_num));
+                }
+                one_num += bits[i];
+            }
+            TEST_ASSERT_EQUAL(length, dynamic_length(dbv));
+            TEST_ASSERT_EQUAL(length - one_num, dynamic_rank_zero(dbv, length));
+        }
+    }
+    dynamic_set_bit(dbv, 0);
+    dynamic_clear_bit(dbv, 1);
+    TEST_ASSERT_TRUE(dynamic_get_bit(dbv, 0));
+    TEST_ASSERT_FALSE(dynamic_get_bit(dbv, 1));
+    destruct_dynamic_bit_vector(dbv);
+    free(bits);
+}
+
+void test_push_back_bits(void)
+{
+    // Grow bit vectors of both rank layouts by chunks of random lengths, one with select
+    // structures built only partway through, and compare them with an array of bits.
+    size_t capacity = 40000;
+    bool *bits = calloc(capacity, sizeof(bool));
+    for (size_t variant = 0; variant < 3; ++variant)
+    {
+        BitVectorOptions options = {0};
+        options.rank_layout = variant == 1 ? RANK_LAYOUT_INTERLEAVED : RANK_LAYOUT_SEPARATE;
+        options.select_mode = SELECT_MODE_SAMPLED;
+        options.lazy_select = variant == 2;
+        options.append_capacity = capacity;
+        uint64_t words[2] = {0x0123456789ABCDEFULL, 0x5};
+        BitVector *bv = construct_bit_vector_from_words_with_options(words, 100, false, &options);
+        size_t length = 100;
+        for (size_t i = 0; i < length; ++i)
+        {
+            bits[i] = words[i / 64] >> (i % 64) & 1;
+        }
+
+        uint64_t state = 11 + variant;
+        for (size_t step = 0; length + 64 <= capacity; ++step)
+        {
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            size_t bit_num = (state >> 20) % 65;
+            uint64_t word = state ^ state << 17;
+            word = (step / 64) % 3 ? word : word & state >> 7 & state << 5;
+            push_back_bits(bv, word, bit_num);
+            for (size_t i = 0; i < bit_num; ++i)
+            {
+                bits[length + i] = word >> i & 1;
+            }
+            length += bit_num;
+
+            if (step % 97 == 0 || length + 64 > capacity)
+            {
+                size_t one_num = 0;
+                for (size_t i = 0; i < length; ++i)
+                {
+                    TEST_ASSERT_EQUAL(one_num, rank_one(bv, i));
+                    if (bits[i])
+                    {
+                        TEST_ASSERT_EQUAL(i, select_one(bv, one_num));
+                    }
+                    else
+                    {
+                        TEST_ASSERT_EQUAL(i, select_zero(bv, i - one_num));
+                    }
+                    one_num += bits[i];
+                }
+                TEST_ASSERT_EQUAL(one_num, rank_one(bv, length));
+            }
+        }
+        destruct_bit_vector(bv);
+    }
+    free(bits);
+}
+
+typedef struct SnapshotQuery
+{
+    SnapshotBitVector *sbv;
+    size_t one_num;
+    size_t error_num;
+} SnapshotQuery;
+
+static void *query_snapshots(void *arg)
+{
+    // Updates move ones around without changing their number, which every snapshot must see
+    // consistently.
+    SnapshotQuery *query = arg;
+    query->error_num = 0;
+    for (size_t i = 0; i < 2000; ++i)
+    {
+        BitVectorSnapshot snapshot = acquire_snapshot(query->sbv);
+        size_t index = i * 7919 % query->one_num;
+        size_t position = snapshot_select_one(snapshot, index);
+        query->error_num += snapshot_rank_one(snapshot, snapshot_length(snapshot)) != query->one_num;
+        query->error_num += !snapshot_get_bit(snapshot, position) || snapshot_rank_one(snapshot, position) != index;
+        release_snapshot(query->sbv, snapshot);
+    }
+    return NULL;
+}
+
+void test_snapshot_bit_vector(void)
+{
+    // Use more than 64 blocks of 4096 bits, so that the tree has two levels of nodes.
+    size_t length = 300000;
+    uint64_t words[4688] = {0};
+    bool *bits = calloc(length, sizeof(bool));
+    uint64_t state = 5;
+    size_t one_num = 0;
+    for (size_t i = 0; i < length; ++i)
+    {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        bits[i] = state >> 62 == 0;
+        words[i / 64] |= (uint64_t)bits[i] << (i % 64);
+        one_num += bits[i];
+    }
+    SnapshotBitVector *sbv = construct_snapshot_bit_vector_from_words(words, length);
+    BitVectorSnapshot first = acquire_snapshot(sbv);
+
+    // Readers query while batches of updates swap ones and zeros.
+    pthread_t threads[2];
+    SnapshotQuery queries[2];
+    for (size_t i = 0; i < 2; ++i)
+    {
+        queries[i] = (SnapshotQuery){sbv, one_num, 0};
+        pthread_create(&threads[i], NULL, query_snapshots, &queries[i]);
+    }
+    for (size_t batch = 0; batch < 300; ++batch)
+    {
+        BitUpdate updates[8];
+        for (size_t u = 0; u < 8; u += 2)
+        {
+            size_t index[2];
+            for (size_t target = 0; target < 2; ++target)
+            {
+                do
+                {
+                    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+                    index[target] = (state >> 33) % length;
+                } while (bits[index[target]] != target);
+                bits[index[target]] = !target;
+                updates[u + target] = (BitUpdate){index[target], !target};
+            }
+        }
+        update_bits(sbv, updates, 8);
+    }
+    for (size_t i = 0; i < 2; ++i)
+    {
+        pthread_join(threads[i], NULL);
+        TEST_ASSERT_EQUAL(0, queries[i].error_num);
+    }
+
+    // The first snapshot still sees the original bits and a new one sees every update.
+    BitVectorSnapshot last = acquire_snapshot(sbv);
+    size_t ranks[2] = {0, 0};
+    for (size_t i = 0; i < length; ++i)
+    {
+        bool original = words[i / 64] >> (i % 64) & 1;
+        TEST_ASSERT_EQUAL(original, snapshot_get_bit(first, i));
+        TEST_ASSERT_EQUAL(ranks[0], snapshot_rank_one(first, i));
+        TEST_ASSERT_EQUAL(bits[i], snapshot_get_bit(last, i));
+        TEST_ASSERT_EQUAL(ranks[1], snapshot_rank_one(last, i));
+        if (bits[i])
+        {
+            TEST_ASSERT_EQUAL(i, snapshot_select_one(last, ranks[1]));
+        }
+        else
+        {
+            TEST_ASSERT_EQUAL(i, snapshot_select_zero(last, i - ranks[1]));
+        }
+        ranks[0] += original;
+        ranks[1] += bits[i];
+    }
+    release_snapshot(sbv, first);
+    release_snapshot(sbv, last);
+    destruct_snapshot_bit_vector(sbv);
+    free(bits);
+}
+
+void test_query_executor(void)
+{
+    // Mixed batches of every size around the chunk size give the same answers as single
+    // queries, on a bit vector whose select structures are built by the first batch.
+    size_t length = 300000;
+    uint64_t *words = malloc((length / 64 + 1) * sizeof(uint64_t));
+    uint64_t state = 3;
+    for (size_t i = 0; i <= length / 64; ++i)
+    {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        words[i] = state;
+    }
+    BitVectorOptions options = {0};
+    options.lazy_select = true;
+    BitVector *lazy = construct_bit_vector_from_words_with_options(words, length, true, &options);
+    size_t one_num = rank_one(lazy, length);
+
+    size_t const batch_sizes[] = {0, 1, 511, 512, 513, 20000};
+    size_t const thread_nums[] = {1, 4};
+    Query *queries = malloc(20000 * sizeof(Query));
+    size_t *results = malloc(20000 * sizeof(size_t));
+    for (size_t t = 0; t < 2; ++t)
+    {
+        QueryExecutor *executor = construct_query_executor(thread_nums[t]);
+        for (size_t b = 0; b < sizeof(batch_sizes) / sizeof(size_t); ++b)
+        {
+            size_t n = batch_sizes[b];
+            for (size_t i = 0; i < n; ++i)
+            {
+                state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+                QueryType type = state >> 62;
+                size_t limit = type == QUERY_SELECT_ONE    ? one_num
+                               : type == QUERY_SELECT_ZERO ? length - one_num
+                                                           : length + 1;
+                queries[i] = (Query){type, (state >> 20) % limit};
+            }
+            execute_queries(executor, lazy, queries, n, results);
+            for (size_t i = 0; i < n; ++i)
+            {
+                size_t expected = queries[i].type == QUERY_RANK_ONE    ? rank_one(lazy, queries[i].index)
+                                  : queries[i].type == QUERY_RANK_ZERO ? rank_zero(lazy, queries[i].index)
+                                  : queries[i].type == QUERY_SELECT_ONE ? select_one(lazy, queries[i].index)
+                                                                        : select_zero(lazy, queries[i].index);
+                TEST_ASSERT_EQUAL(expected, results[i]);
+            }
+        }
+        destruct_query_executor(executor);
+    }
+    destruct_bit_vector(lazy);
+    free(queries);
+    free(results);
+    free(words);
+}
+
+void test_numa_replicas(void)
+{
+    // Replicated bit vectors answer like plain ones on every node, including after growing,
+    // both on the machine itself and on a pretended one of 3 nodes.
+    uint64_t words[256];
+    for (size_t i = 0; i < 256; ++i)
+    {
+        words[i] = 0xFEDCBA9876543210 * (i + 3);
+    }
+    for (size_t node_num = 1; node_num <= 3; node_num += 2)
+    {
+        for (size_t variant = 0; variant < 2; ++variant)
+        {
+            BitVectorOptions options = {0};
+            options.select_mode = variant ? SELECT_MODE_SAMPLED : SELECT_MODE_TREE;
+            options.lazy_select = !variant;
+            options.append_capacity = variant ? 256 * 64 : 0;
+            size_t length = variant ? 200 * 64 : 256 * 64;
+            BitVector *plain = construct_bit_vector_from_words_with_options(words, length, false, &options);
+            options.numa_replicas = true;
+            bv_numa_override_topology(node_num > 1 ? node_num : 0, 1);
+            BitVector *replicated = construct_bit_vector_from_words_with_options(words, length, true, &options);
+            for (size_t w = 200; variant && w < 256; ++w)
+            {
+                push_back_bits(plain, words[w], 64);
+                push_back_bits(replicated, words[w], 64);
+            }
+
+            size_t one_num = rank_one(plain, 256 * 64);
+            for (size_t node = 0; node < node_num; ++node)
+            {
+                bv_numa_override_topology(node_num > 1 ? node_num : 0, node);
+                TEST_ASSERT_EQUAL(one_num, rank_one(replicated, 256 * 64));
+                for (size_t i = 0; i <= 256 * 64; i += 37)
+                {
+                    TEST_ASSERT_EQUAL(rank_one(plain, i), rank_one(replicated, i));
+                }
+                for (size_t i = 0; i < one_num; i += 11)
+                {
+                    TEST_ASSERT_EQUAL(select_one(plain, i), select_one(replicated, i));
+                }
+                for (size_t i = 0; i < 256 * 64 - one_num; i += 11)
+                {
+                    TEST_ASSERT_EQUAL(select_zero(plain, i), select_zero(replicated, i));
+                }
+            }
+            TEST_ASSERT_TRUE(bit_vector_space_usage(replicated).bytes[SPACE_PAYLOAD] >=
+                             node_num * bit_vector_space_usage(plain).bytes[SPACE_PAYLOAD]);
+
+            destruct_bit_vector(plain);
+            destruct_bit_vector(replicated);
+            bv_numa_override_topology(0, 0);
+        }
+    }
+}
+
+void test_huge_pages(void)
+{
+    // Bit vectors with bits and structures larger than a huge page answer like ones in
+    // ordinary pages, whether they are fixed or grow.
+    size_t length = 20000000;
+    uint64_t *words = malloc((length / 64 + 1) * sizeof(uint64_t));
+    uint64_t state = 5;
+    for (size_t i = 0; i <= length / 64; ++i)
+    {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        words[i] = state;
+    }
+    for (size_t variant = 0; variant < 3; ++variant)
+    {
+        BitVectorOptions options = {0};
+        options.rank_layout = variant == 1 ? RANK_LAYOUT_INTERLEAVED : RANK_LAYOUT_SEPARATE;
+        options.select_mode = SELECT_MODE_SAMPLED;
+        options.append_capacity = variant == 2 ? length : 0;
+        size_t initial_length = variant == 2 ? length - 64 * 1000 : length;
+        BitVector *plain = construct_bit_vector_from_words_with_options(words, length, true, &options);
+        options.huge_pages = true;
+        BitVector *huge = construct_bit_vector_from_words_with_options(words, initial_length, false, &options);
+        for (size_t w = initial_length / 64; w < length / 64; ++w)
+        {
+            push_back_bits(huge, words[w], 64);
+        }
+
+        size_t one_num = rank_one(plain, length);
+        TEST_ASSERT_EQUAL(one_num, rank_one(huge, length));
+        for (size_t i = 0; i < 100000; ++i)
+        {
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            size_t index = (state >> 20) % length;
+            TEST_ASSERT_EQUAL(rank_one(plain, index), rank_one(huge, index));
+            TEST_ASSERT_EQUAL(select_one(plain, index % one_num), select_one(huge, index % one_num));
+            TEST_ASSERT_EQUAL(select_zero(plain, index % (length - one_num)),
+                              select_zero(huge, index % (length - one_num)));
+        }
+        TEST_ASSERT_EQUAL(bit_vector_space_usage(plain).bytes[SPACE_PAYLOAD],
+                          bit_vector_space_usage(huge).bytes[SPACE_PAYLOAD]);
+
+        destruct_bit_vector(plain);
+        destruct_bit_vector(huge);
+    }
+    free(words);
+}
+
 int main(void)
 {
     UNITY_BEGIN();
@@ -101,6 +1125,29 @@ int main(void)
     RUN_TEST(test_select_one_short_block);
     RUN_TEST(test_select_zero_long_block);
     RUN_TEST(test_select_zero_short_block);
+    RUN_TEST(test_construct_from_words);
+    RUN_TEST(test_construct_from_read_only_words);
+    RUN_TEST(test_parse_with_separators);
+    RUN_TEST(test_rank_one_across_words);
+    RUN_TEST(test_rank_one_interleaved_layout);
+    RUN_TEST(test_select_sampled_mode);
+    RUN_TEST(test_save_and_map);
+    RUN_TEST(test_map_rejects_corrupt_files);
+    RUN_TEST(test_rank_batch);
+    RUN_TEST(test_select_batch);
+    RUN_TEST(test_parallel_construction);
+    RUN_TEST(test_lazy_select);
+    RUN_TEST(test_space_usage);
+    RUN_TEST(test_rrr_encoding);
+    RUN_TEST(test_elias_fano_encoding);
+    RUN_TEST(test_run_length_encoding);
+    RUN_TEST(test_hybrid_encoding);
+    RUN_TEST(test_dynamic_bit_vector);
+    RUN_TEST(test_push_back_bits);
+    RUN_TEST(test_snapshot_bit_vector);
+    RUN_TEST(test_query_executor);
+    RUN_TEST(test_numa_replicas);
+    RUN_TEST(test_huge_pages);
     destruct_bit_vector(bv);
     return UNITY_END();
 }
@@ -0,0 +1,238 @@
+#include "unity.h"
+#include "bit_vector.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+// This test is built with ThreadSanitizer when the compiler supports it, which reports any
+// data race between the threads below as a failure.
+
+#define LENGTH 100000
+#define THREAD_NUMBER 8
+#define QUERY_NUMBER 2000
+
+typedef struct Expected
+{
+    size_t one_num;
+    size_t ranks[QUERY_NUMBER];
+    size_t ones[QUERY_NUMBER];
+    size_t zeros[QUERY_NUMBER];
+} Expected;
+
+typedef struct Reader
+{
+    BitVector const *bv;
+    Expected const *expected;
+    pthread_barrier_t *barrier;
+    size_t thread;
+    size_t error_num;
+} Reader;
+
+uint64_t words[LENGTH / 64 + 1];
+size_t indexes[QUERY_NUMBER];
+Expected expected;
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+static void *read_bit_vector(void *arg)
+{
+    // Start all threads at once, so that the first select queries of lazy bit vectors race,
+    // then mix single and batch queries in an order of our own.
+    Reader *reader = arg;
+    Expected const *expected = reader->expected;
+    size_t *results = malloc(QUERY_NUMBER * sizeof(size_t));
+    size_t *select_indexes = malloc(QUERY_NUMBER * sizeof(size_t));
+    reader->error_num = 0;
+    pthread_barrier_wait(reader->barrier);
+    for (size_t q = 0; q < QUERY_NUMBER; ++q)
+    {
+        size_t i = (q + reader->thread * 997) % QUERY_NUMBER;
+        size_t one = indexes[i] % expected->one_num;
+        size_t zero = indexes[i] % (LENGTH - expected->one_num);
+        reader->error_num += rank_one(reader->bv, indexes[i]) != expected->ranks[i];
+        reader->error_num += rank_zero(reader->bv, indexes[i]) != indexes[i] - expected->ranks[i];
+        if (reader->thread % 2)
+        {
+            reader->error_num += select_one(reader->bv, one) != expected->ones[i];
+            reader->error_num += select_zero(reader->bv, zero) != expected->zeros[i];
+        }
+        else
+        {
+            reader->error_num += select_zero(reader->bv, zero) != expected->zeros[i];
+            reader->error_num += select_one(reader->bv, one) != expected->ones[i];
+        }
+    }
+    rank_one_batch(reader->bv, indexes, QUERY_NUMBER, results);
+    for (size_t i = 0; i < QUERY_NUMBER; ++i)
+    {
+        reader->error_num += results[i] != expected->ranks[i];
+        select_indexes[i] = indexes[i] % expected->one_num;
+    }
+    select_one_batch(reader->bv, select_indexes, QUERY_NUMBER, results);
+    for (size_t i = 0; i < QUERY_NUMBER; ++i)
+    {
+        reader->error_num += results[i] != expected->ones[i];
+    }
+    bit_vector_space_usage(reader->bv);
+    free(results);
+    free(select_indexes);
+    return NULL;
+}
+
+static void check_concurrent_queries(BitVectorOptions const *options)
+{
+    BitVector *bv = construct_bit_vector_from_words_with_options(words, LENGTH, true, options);
+    pthread_t threads[THREAD_NUMBER];
+    Reader readers[THREAD_NUMBER];
+    pthread_barrier_t barrier;
+    TEST_ASSERT_EQUAL(0, pthread_barrier_init(&barrier, NULL, THREAD_NUMBER));
+    for (size_t t = 0; t < THREAD_NUMBER; ++t)
+    {
+        readers[t] = (Reader){bv, &expected, &barrier, t, 0};
+        TEST_ASSERT_EQUAL(0, pthread_create(&threads[t], NULL, read_bit_vector, &readers[t]));
+    }
+    for (size_t t = 0; t < THREAD_NUMBER; ++t)
+    {
+        pthread_join(threads[t], NULL);
+        TEST_ASSERT_EQUAL(0, readers[t].error_num);
+    }
+    pthread_barrier_destroy(&barrier);
+    destruct_bit_vector(bv);
+}
+
+void test_concurrent_queries_tree(void)
+{
+    BitVectorOptions options = {0};
+    check_concurrent_queries(&options);
+}
+
+void test_concurrent_queries_lazy_tree(void)
+{
+    BitVectorOptions options = {0};
+    options.lazy_select = true;
+    check_concurrent_queries(&options);
+}
+
+void test_concurrent_queries_lazy_sampled(void)
+{
+    BitVectorOptions options = {0};
+    options.rank_layout = RANK_LAYOUT_INTERLEAVED;
+    options.select_mode = SELECT_MODE_SAMPLED;
+    options.lazy_select = true;
+    check_concurrent_queries(&options);
+}
+
+void test_concurrent_queries_encoded(void)
+{
+    Encoding const encodings[] = {ENCODING_RRR, ENCODING_ELIAS_FANO, ENCODING_RUN_LENGTH, ENCODING_HYBRID};
+    for (size_t i = 0; i < sizeof(encodings) / sizeof(Encoding); ++i)
+    {
+        BitVectorOptions options = {0};
+        options.encoding = encodings[i];
+        check_concurrent_queries(&options);
+    }
+}
+
+typedef struct Submitter
+{
+    QueryExecutor *executor;
+    BitVector const *bv;
+    Query *queries;
+    size_t error_num;
+} Submitter;
+
+static void *submit_queries(void *arg)
+{
+    Submitter *submitter = arg;
+    size_t *results = malloc(QUERY_NUMBER * sizeof(size_t));
+    submitter->error_num = 0;
+    for (size_t round = 0; round < 4; ++round)
+    {
+        execute_queries(submitter->executor, submitter->bv, submitter->queries, QUERY_NUMBER, results);
+        for (size_t i = 0; i < QUERY_NUMBER; ++i)
+        {
+            size_t answer = submitter->queries[i].type == QUERY_RANK_ONE ? expected.ranks[i] : expected.ones[i];
+            submitter->error_num += results[i] != answer;
+        }
+    }
+    free(results);
+    return NULL;
+}
+
+void test_concurrent_executor_batches(void)
+{
+    // Batches from two threads share one executor and a lazy bit vector.
+    BitVectorOptions options = {0};
+    options.lazy_select = true;
+    BitVector *bv = construct_bit_vector_from_words_with_options(words, LENGTH, true, &options);
+    QueryExecutor *executor = construct_query_executor(4);
+    Query *queries = malloc(QUERY_NUMBER * sizeof(Query));
+    for (size_t i = 0; i < QUERY_NUMBER; ++i)
+    {
+        queries[i] = i % 2 ? (Query){QUERY_SELECT_ONE, indexes[i] % expected.one_num}
+                           : (Query){QUERY_RANK_ONE, indexes[i]};
+    }
+    pthread_t threads[2];
+    Submitter submitters[2];
+    for (size_t t = 0; t < 2; ++t)
+    {
+        submitters[t] = (Submitter){executor, bv, queries, 0};
+        TEST_ASSERT_EQUAL(0, pthread_create(&threads[t], NULL, submit_queries, &submitters[t]));
+    }
+    for (size_t t = 0; t < 2; ++t)
+    {
+        pthread_join(threads[t], NULL);
+        TEST_ASSERT_EQUAL(0, submitters[t].error_num);
+    }
+    free(queries);
+    destruct_query_executor(executor);
+    destruct_bit_vector(bv);
+}
+
+int main(void)
+{
+    // Compute expected answers with the bits themselves.
+    uint64_t state = 17;
+    for (size_t i = 0; i <= LENGTH / 64; ++i)
+    {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        words[i] = state & state << 7;
+    }
+    words[LENGTH / 64] &= ((uint64_t)1 << (LENGTH % 64)) - 1;
+    size_t *positions[2];
+    positions[0] = malloc(LENGTH * sizeof(size_t));
+    positions[1] = malloc(LENGTH * sizeof(size_t));
+    size_t counts[2] = {0, 0};
+    for (size_t i = 0; i < LENGTH; ++i)
+    {
+        bool bit = words[i / 64] >> (i % 64) & 1;
+        positions[bit][counts[bit]++] = i;
+    }
+    expected.one_num = counts[1];
+    for (size_t i = 0; i < QUERY_NUMBER; ++i)
+    {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        indexes[i] = (state >> 20) % LENGTH;
+        size_t rank = 0;
+        while (rank < counts[1] && positions[1][rank] < indexes[i])
+        {
+            ++rank;
+        }
+        expected.ranks[i] = rank;
+        expected.ones[i] = positions[1][indexes[i] % counts[1]];
+        expected.zeros[i] = positions[0][indexes[i] % counts[0]];
+    }
+    free(positions[0]);
+    free(positions[1]);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_concurrent_queries_tree);
+    RUN_TEST(test_concurrent_queries_lazy_tree);
+    RUN_TEST(test_concurrent_queries_lazy_sampled);
+    RUN_TEST(test_concurrent_queries_encoded);
+    RUN_TEST(test_concurrent_executor_batches);
+    return UNITY_END();
+}